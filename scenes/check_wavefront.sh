@@ -0,0 +1,38 @@
+#!/bin/bash
+#Run this from scenes directory
+#Checks that wavefront pathtracing renders the same image means as the megakernel, with and without photon maps
+
+function check_error {
+    if [ "$?" -ne "0" ]; then
+        cd ..
+        echo "An error occurred!"
+        exit 1
+    fi
+}
+
+# image mean printed by trace for the given options
+function trace_mean {
+    ../trace -p -m -r 64 -s 32 "$@" scene_cornellbox.json wavefront_check.png | grep "^Mean:"
+}
+
+# fails if two means differ by more than 2% on any channel
+function check_means {
+    echo "  megakernel $1"
+    echo "  wavefront  $2"
+    echo "$1 $2" | awk '{ for(i = 2; i <= 4; i ++) { d = $i - $(i+4); if(d < 0) d = -d; if(d > 0.02 * ($i + 0.01)) exit 1 } }'
+}
+
+for options in "" "-M 200000" "-M 200000 -G"; do
+    echo "Pathtracing $options"
+    megakernel=$(trace_mean $options)
+    check_error
+    wavefront=$(trace_mean -W $options)
+    check_error
+    check_means "$megakernel" "$wavefront"
+    check_error
+done
+
+rm -f wavefront_check.png
+echo "All completed successfully!"
+
+cd ..
@@ -0,0 +1,131 @@
+#include "igl/serialize.h"
+#include "igl/scene.h"
+#include "igl/intersect.h"
+#include "igl/tesselate.h"
+#include "igl/accelerator.h"
+#include "tclap/CmdLine.h"
+
+#include "vmath/random.h"
+#include "common/std_utils.h"
+
+///@file apps/accelbench.cpp Accelbench: compares and times the scene accelerators @ingroup apps
+///@defgroup accelbench Accelbench: compares and times the scene accelerators
+///@ingroup apps
+///@{
+
+string filename_scene; ///< scene filename
+int resolution = 256; ///< camera rays resolution
+vector<string> accelerator_types = { "none", "bvh", "grid" }; ///< accelerator types ("none" for brute force), the first is the reference
+
+/// first hit of a ray, with the primitive as an index so that hits of different scene loads compare
+struct RayHit {
+    bool    hit = false; ///< whether the ray hit
+    float   t = 0; ///< hit distance
+    int     prim = -1; ///< hit primitive index
+};
+
+/// parse command line arguments
+void parse_args(int argc, char** argv) {
+	try {
+        TCLAP::CmdLine cmd("accelbench", ' ', "0.0");
+        TCLAP::ValueArg<int> resolutionArg("r","resolution","Camera rays resolution",false,256,"int",cmd);
+        TCLAP::MultiArg<string> acceleratorArg("a","accelerator","Accelerator types: none, bvh or grid (the first is the reference)",false,"type",cmd);
+        TCLAP::UnlabeledValueArg<string> filenameScene("scene","Scene filename",true,"","filename",cmd);
+        cmd.parse( argc, argv );
+        if(resolutionArg.isSet()) resolution = resolutionArg.getValue();
+        if(acceleratorArg.isSet()) accelerator_types = acceleratorArg.getValue();
+        filename_scene = filenameScene.getValue();
+	} catch (TCLAP::ArgException &e) {
+        std::cerr << "error: " << e.error() << " for arg " << e.argId() << std::endl;
+    }
+}
+
+/// loads the scene with every shape and group using the given accelerator type, or none
+Scene* load_scene(const string& type, double& build_time) {
+    Scene* scene = nullptr;
+    Serializer::read_json(scene, filename_scene);
+    scene_tesselation_init(scene,false,0,false);
+    auto set_type = [&type](string& accelerator_type, bool& accelerator_use) {
+        if(type == "none") accelerator_use = false;
+        else accelerator_type = type;
+    };
+    set_type(scene->prims->intersect_accelerator_type, scene->prims->intersect_accelerator_use);
+    for(auto prim : scene->prims->prims) {
+        auto shape = (is<Surface>(prim)) ? cast<Surface>(prim)->shape : ((is<TransformedSurface>(prim)) ? cast<TransformedSurface>(prim)->shape : nullptr);
+        if(shape) set_type(shape->intersect_accelerator_type, shape->intersect_accelerator_use);
+    }
+    auto build_timer = timer();
+    intersect_scene_accelerate(scene);
+    build_time = build_timer.elapsed();
+    return scene;
+}
+
+/// index of the primitive of an intersection
+int prim_index(Scene* scene, Primitive* prim) {
+    auto& prims = scene->prims->prims;
+    auto it = std::find(prims.begin(), prims.end(), prim);
+    return (it == prims.end()) ? -1 : (int)(it - prims.begin());
+}
+
+/// camera rays through the pixel centers, and from each of their hits a ray in a random direction
+vector<ray3f> generate_rays(Scene* scene) {
+    auto w = camera_image_width(scene->camera, resolution);
+    auto h = camera_image_height(scene->camera, resolution);
+    auto rays = vector<ray3f>();
+    auto rng = Rng();
+    for(auto j : range(h)) for(auto i : range(w)) {
+        auto ray = camera_ray(scene->camera, vec2f((i+0.5f)/w,(j+0.5f)/h));
+        rays.push_back(ray);
+        intersection3f intersection;
+        if(not intersect_scene_first(scene, ray, intersection)) continue;
+        auto ds = sample_direction_spherical(rng.next_vec2f());
+        rays.push_back(ray3f(intersection.frame.o, ds.dir));
+    }
+    return rays;
+}
+
+/// main: loads the scene once per accelerator type, times first and any hit queries over the same rays,
+/// and counts the rays whose results differ from the reference type
+int main(int argc, char** argv) {
+    parse_args(argc,argv);
+    auto rays = vector<ray3f>();
+    auto reference = vector<RayHit>();
+    auto mismatches = 0;
+    printf("%-6s %10s %10s %10s %10s\n", "type", "build", "first", "any", "mismatch");
+    for(auto type : accelerator_types) {
+        auto build_time = 0.0;
+        auto scene = load_scene(type, build_time);
+        if(rays.empty()) rays = generate_rays(scene);
+
+        auto hits = vector<RayHit>(rays.size());
+        auto prims = vector<Primitive*>(rays.size(), nullptr);
+        auto first_timer = timer();
+        for(auto i : range(rays.size())) {
+            intersection3f intersection;
+            hits[i].hit = intersect_scene_first(scene, rays[i], intersection);
+            if(hits[i].hit) { hits[i].t = intersection.ray_t; prims[i] = intersection.prim; }
+        }
+        auto first_time = first_timer.elapsed();
+        auto any = vector<bool>(rays.size());
+        auto any_timer = timer();
+        for(auto i : range(rays.size())) any[i] = intersect_scene_any(scene, rays[i]);
+        auto any_time = any_timer.elapsed();
+        for(auto i : range(rays.size())) if(hits[i].hit) hits[i].prim = prim_index(scene, prims[i]);
+
+        // the same element hit at the same distance, within the precision of the ray-shape tests
+        auto type_mismatches = 0;
+        if(reference.empty()) reference = hits;
+        for(auto i : range(rays.size())) {
+            auto& a = reference[i]; auto& b = hits[i];
+            auto same = (a.hit == b.hit) and (a.hit == any[i]) and
+                        (not a.hit or (a.prim == b.prim and abs(a.t - b.t) <= 1e-4f * max(1.0f, a.t)));
+            if(not same) type_mismatches ++;
+        }
+        mismatches += type_mismatches;
+        printf("%-6s %9.3fs %9.3fs %9.3fs %10d\n", type.c_str(), build_time, first_time, any_time, type_mismatches);
+    }
+    printf("%d rays\n", (int)rays.size());
+    return (mismatches) ? 1 : 0;
+}
+
+///@}
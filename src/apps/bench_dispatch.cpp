@@ -0,0 +1,93 @@
+#include "igl/shape.h"
+#include "tclap/CmdLine.h"
+
+#include "vmath/random.h"
+#include "common/std_utils.h"
+
+///@file apps/bench_dispatch.cpp Bench_dispatch: times the shape type dispatch with is<> against a switch on node_typeuid @ingroup apps
+///@defgroup bench_dispatch Bench_dispatch: times the shape type dispatch with is<> against a switch on node_typeuid
+///@ingroup apps
+///@{
+
+int num_shapes = 1024; ///< shapes dispatched per round, few enough to stay in L1
+int num_rounds = 100000; ///< rounds over the shapes
+
+/// parse command line arguments
+void parse_args(int argc, char** argv) {
+	try {
+        TCLAP::CmdLine cmd("bench_dispatch", ' ', "0.0");
+        TCLAP::ValueArg<int> shapesArg("n","shapes","Shapes dispatched per round",false,1024,"int",cmd);
+        TCLAP::ValueArg<int> roundsArg("r","rounds","Rounds over the shapes",false,100000,"int",cmd);
+        cmd.parse( argc, argv );
+        if(shapesArg.isSet()) num_shapes = shapesArg.getValue();
+        if(roundsArg.isSet()) num_rounds = roundsArg.getValue();
+	} catch (TCLAP::ArgException &e) {
+        std::cerr << "error: " << e.error() << " for arg " << e.argId() << std::endl;
+    }
+}
+
+/// dispatch with the is<> chain, in the order intersect_shape_any tests the shapes
+__attribute__((noinline)) float dispatch_is(Shape* shape) {
+    if(is<PointSet>(shape)) return cast<PointSet>(shape)->pos.size();
+    else if(is<LineSet>(shape)) return cast<LineSet>(shape)->line.size();
+    else if(is<TriangleMesh>(shape)) return cast<TriangleMesh>(shape)->triangle.size();
+    else if(is<Mesh>(shape)) return cast<Mesh>(shape)->triangle.size();
+    else if(is<FaceMesh>(shape)) return cast<FaceMesh>(shape)->triangle.size();
+    else if(is<Sphere>(shape)) return cast<Sphere>(shape)->radius;
+    else if(is<Cylinder>(shape)) return cast<Cylinder>(shape)->height;
+    else if(is<Quad>(shape)) return cast<Quad>(shape)->width;
+    else if(is<Triangle>(shape)) return cast<Triangle>(shape)->v0.x;
+    else return 0;
+}
+
+/// dispatch with a switch on the concrete type id
+__attribute__((noinline)) float dispatch_switch(Shape* shape) {
+    switch(node_typeuid(shape)) {
+        case PointSet::_typeuid: return cast<PointSet>(shape)->pos.size();
+        case LineSet::_typeuid: return cast<LineSet>(shape)->line.size();
+        case TriangleMesh::_typeuid: return cast<TriangleMesh>(shape)->triangle.size();
+        case Mesh::_typeuid: return cast<Mesh>(shape)->triangle.size();
+        case FaceMesh::_typeuid: return cast<FaceMesh>(shape)->triangle.size();
+        case Sphere::_typeuid: return cast<Sphere>(shape)->radius;
+        case Cylinder::_typeuid: return cast<Cylinder>(shape)->height;
+        case Quad::_typeuid: return cast<Quad>(shape)->width;
+        case Triangle::_typeuid: return cast<Triangle>(shape)->v0.x;
+        default: return 0;
+    }
+}
+
+/// nanoseconds per dispatch over all rounds; the sum is returned to keep the calls
+template<typename F>
+double time_dispatch(const vector<Shape*>& shapes, const F& dispatch, float& sum) {
+    auto dispatch_timer = timer();
+    for(auto r = 0; r < num_rounds; r ++) for(auto shape : shapes) sum += dispatch(shape);
+    return dispatch_timer.elapsed() * 1e9 / (double(num_rounds) * shapes.size());
+}
+
+/// main: times both dispatches over shapes of a single type, and of the four analytic types in random order
+int main(int argc, char** argv) {
+    parse_args(argc,argv);
+    auto rng = Rng();
+    auto single = vector<Shape*>();
+    auto mixed = vector<Shape*>();
+    for(auto i = 0; i < num_shapes; i ++) {
+        single.push_back(new Sphere());
+        switch(int(rng.next_float() * 4) % 4) {
+            case 0: mixed.push_back(new Sphere()); break;
+            case 1: mixed.push_back(new Cylinder()); break;
+            case 2: mixed.push_back(new Quad()); break;
+            default: mixed.push_back(new Triangle()); break;
+        }
+    }
+    auto sum = 0.0f;
+    printf("%-22s %10s %10s\n", "shapes", "is<>", "switch");
+    for(auto& test : { make_pair(string("single type"),&single), make_pair(string("random of 4 types"),&mixed) }) {
+        auto is_time = time_dispatch(*test.second, dispatch_is, sum);
+        auto switch_time = time_dispatch(*test.second, dispatch_switch, sum);
+        printf("%-22s %8.2fns %8.2fns\n", test.first.c_str(), is_time, switch_time);
+    }
+    printf("checksum %g\n", sum);
+    return 0;
+}
+
+///@}
@@ -8,6 +8,8 @@
 #include "igl/distraytrace.h"
 #include "igl/pathtrace.h"
 #include "igl/tesselate.h"
+#include "igl/accelerator.h"
+#include "common/std_utils.h"
 
 #include <thread>
 
@@ -35,6 +37,21 @@ string filename_image; ///< rendered image filename
 int resolution = -1;
 int samples = -1;
 
+string bvh_cache_dir; ///< directory for cached bvh builds (empty for no caching)
+string accelerator_type; ///< accelerator type for all shapes and groups (empty to keep the scene settings)
+string texture_cache_dir; ///< directory for paged textures (empty to keep textures resident)
+int texture_budget = -1; ///< texture cache budget in MB (negative for the default)
+bool env_irradiance = false; ///< shade diffuse env lighting with prefiltered irradiance (preview)
+string light_selection; ///< light selection strategy (empty to keep the scene settings)
+int light_samples = -1; ///< lights picked per shading point with light selection
+bool adaptive_shadows = false; ///< adaptive area light shadow rays in distribution raytracing
+int threads = -1; ///< pathtracing threads (negative to keep the scene settings)
+bool bidirectional = false; ///< bidirectional pathtracing
+bool wavefront = false; ///< wavefront pathtracing
+int photons = -1; ///< photons emitted for photon mapping (negative to keep the scene settings)
+bool final_gather = false; ///< photon map final gather in pathtracing
+bool print_mean = false; ///< print the image mean (used by the render checks)
+
 /// parse command line arguments
 void parse_args(int argc, char** argv) {
 	try {  
@@ -48,6 +65,21 @@ void parse_args(int argc, char** argv) {
         TCLAP::SwitchArg distributionArg("d","distribution_raytrace","Distribution Raytracing",cmd);
         TCLAP::SwitchArg pathtraceArg("p","pathtrace","Pathtracing",cmd);
         
+        TCLAP::ValueArg<string> bvhCacheArg("c","bvh_cache","BVH cache directory",false,"","dirname",cmd);
+        TCLAP::ValueArg<string> acceleratorArg("a","accelerator","Accelerator type (bvh or grid)",false,"","type",cmd);
+        TCLAP::ValueArg<string> textureCacheArg("T","texture_cache","Texture cache directory",false,"","dirname",cmd);
+        TCLAP::ValueArg<int> textureBudgetArg("B","texture_budget","Texture cache budget in MB",false,0,"int",cmd);
+        TCLAP::ValueArg<string> lightSelectionArg("L","light_selection","Light selection (all, power or bvh)",false,"","type",cmd);
+        TCLAP::ValueArg<int> lightSamplesArg("l","light_samples","Lights picked per shading point with light selection",false,0,"int",cmd);
+        TCLAP::ValueArg<int> threadsArg("t","threads","Pathtracing threads (0 for all cores)",false,0,"int",cmd);
+        TCLAP::SwitchArg bidirectionalArg("b","bidirectional","Bidirectional pathtracing",cmd);
+        TCLAP::SwitchArg wavefrontArg("W","wavefront","Wavefront pathtracing over ray queues",cmd);
+        TCLAP::ValueArg<int> photonsArg("M","photons","Photons emitted for photon mapping (0 for off)",false,0,"int",cmd);
+        TCLAP::SwitchArg finalGatherArg("G","final_gather","Photon map final gather in pathtracing",cmd);
+        TCLAP::SwitchArg adaptiveShadowsArg("A","adaptive_shadows","Adaptive area light shadow rays",cmd);
+        TCLAP::SwitchArg envIrradianceArg("I","env_irradiance","Prefiltered environment irradiance for diffuse shading",cmd);
+        TCLAP::SwitchArg meanArg("m","mean","Print the image mean",cmd);
+        
         TCLAP::UnlabeledValueArg<string> filenameScene("scene","Scene filename",true,"","filename",cmd);
         TCLAP::UnlabeledValueArg<string> filenameImage("image","Image filename",false,"","filename",cmd);
         
@@ -59,6 +91,20 @@ void parse_args(int argc, char** argv) {
         if(resolutionArg.isSet()) resolution = resolutionArg.getValue();
         if(samplesArg.isSet()) samples = samplesArg.getValue();
         if(progressiveArg.isSet()) progressive = progressiveArg.getValue();
+        if(bvhCacheArg.isSet()) bvh_cache_dir = bvhCacheArg.getValue();
+        if(acceleratorArg.isSet()) accelerator_type = acceleratorArg.getValue();
+        if(textureCacheArg.isSet()) texture_cache_dir = textureCacheArg.getValue();
+        if(textureBudgetArg.isSet()) texture_budget = textureBudgetArg.getValue();
+        if(lightSelectionArg.isSet()) light_selection = lightSelectionArg.getValue();
+        if(lightSamplesArg.isSet()) light_samples = lightSamplesArg.getValue();
+        if(threadsArg.isSet()) threads = threadsArg.getValue();
+        if(bidirectionalArg.isSet()) bidirectional = bidirectionalArg.getValue();
+        if(wavefrontArg.isSet()) wavefront = wavefrontArg.getValue();
+        if(photonsArg.isSet()) photons = photonsArg.getValue();
+        if(finalGatherArg.isSet()) final_gather = finalGatherArg.getValue();
+        if(adaptiveShadowsArg.isSet()) adaptive_shadows = adaptiveShadowsArg.getValue();
+        if(envIrradianceArg.isSet()) env_irradiance = envIrradianceArg.getValue();
+        if(meanArg.isSet()) print_mean = meanArg.getValue();
         
         filename_scene = filenameScene.getValue();
         if(filenameImage.isSet()) filename_image = filenameImage.getValue();
@@ -68,13 +114,22 @@ void parse_args(int argc, char** argv) {
     }
 }
 
+/// overrides the accelerator type of the scene group and of all surface shapes
+void override_accelerator_type(Scene* scene, const string& type) {
+    scene->prims->intersect_accelerator_type = type;
+    for(auto prim : scene->prims->prims) {
+        if(is<Surface>(prim)) cast<Surface>(prim)->shape->intersect_accelerator_type = type;
+        else if(is<TransformedSurface>(prim)) cast<TransformedSurface>(prim)->shape->intersect_accelerator_type = type;
+    }
+}
+
 void init_buffers(int w, int h) {
     trace_image_buffer = ImageBuffer(w, h);
 }
 
 void render_pass(image3f& img) {
     if(distribution) distraytrace_scene_progressive(trace_image_buffer, scene, disttrace_opts);
-    else if(pathtrace) PUT_YOUR_CODE_HERE("Pathtracing");
+    else if(pathtrace) pathtrace_scene_progressive(trace_image_buffer, scene, pathtrace_opts);
     else raytrace_scene_progressive(trace_image_buffer, scene, opts);
 }
 
@@ -91,7 +146,12 @@ void transfer(image3f& img) {
 /// main: load scene, initialize acceleration, raytraces scene, saves image
 int main(int argc, char** argv) {
     parse_args(argc,argv);
+    TextureCache::cache_dir = texture_cache_dir;
+    if(texture_budget >= 0) TextureCache::budget = (long long)texture_budget << 20;
     Serializer::read_json(scene, filename_scene);
+    auto rstats = Serializer::resource_stats();
+    if(rstats.shared) printf("Shared resources: %d references to %d loaded, saved %.1f MB and %.3fs\n",
+                             rstats.shared, rstats.loaded, rstats.bytes_saved / 1048576.0, rstats.seconds_saved);
     if(scene->raytrace_opts) opts = *scene->raytrace_opts;
     if(scene->distribution_opts) disttrace_opts = *scene->distribution_opts;
     if(scene->pathtrace_opts) pathtrace_opts = *scene->pathtrace_opts;
@@ -102,6 +162,23 @@ int main(int argc, char** argv) {
         disttrace_opts.res = resolution;
         pathtrace_opts.res = resolution;
     }
+    if(not light_selection.empty()) {
+        opts.light_selection = light_selection;
+        disttrace_opts.light_selection = light_selection;
+    }
+    if(light_samples > 0) {
+        opts.light_samples = light_samples;
+        disttrace_opts.light_samples = light_samples;
+    }
+    if(adaptive_shadows) disttrace_opts.adaptive_shadows = true;
+    if(threads >= 0) pathtrace_opts.threads = threads;
+    if(bidirectional) pathtrace_opts.bidirectional = true;
+    if(wavefront) pathtrace_opts.wavefront = true;
+    if(photons >= 0) {
+        disttrace_opts.photons = photons;
+        pathtrace_opts.photons = photons;
+    }
+    if(final_gather) pathtrace_opts.photons_final_gather = true;
     if(samples > 0) {
         opts.samples = samples;
         disttrace_opts.samples = samples;
@@ -110,15 +187,28 @@ int main(int argc, char** argv) {
 
     scene_tesselation_init(scene,false,0,false);
     //scene_animation_snapshot(scene,opts.time);
+    if(env_irradiance) for(auto light : scene->lights->lights) if(is<EnvLight>(light)) cast<EnvLight>(light)->irradiance_sh = true;
+    scene_emitters_init(scene);
     sample_lights_init(scene->lights);
+    scene_materials_init(scene);
     if(opts.cameralights) scene_cameralights_update(scene,opts.cameralights_dir, opts.cameralights_col);
+    BVHAccelerator::cache_dir = bvh_cache_dir;
+    if(not accelerator_type.empty()) override_accelerator_type(scene, accelerator_type);
+    auto build_timer = timer();
     intersect_scene_accelerate(scene);
+    printf("Build: %.3fs\n", build_timer.elapsed());
+    auto tstats = texture_stats();
+    if(tstats.textures) printf("Textures: %d, %.1f MB resident, %.1f MB paged (%.1f MB as float)\n", tstats.textures,
+                               tstats.bytes / 1048576.0, tstats.paged_bytes / 1048576.0, tstats.float_bytes / 1048576.0);
     
     auto w = camera_image_width(scene->camera, opts.res);
     auto h = camera_image_height(scene->camera, opts.res);
     image<vec3f> img;
     init_buffers(w, h);
     auto samples = (pathtrace ? pathtrace_opts.samples : (distribution ? disttrace_opts.samples : opts.samples ) );
+    intersect_shadow_stats_reset();
+    texture_cache_stats_reset();
+    auto render_timer = timer();
     for(auto s = 0; s < samples; s ++) {
         printf("Pass: %02d/%02d\n", s, samples);
         render_pass(img);
@@ -127,7 +217,30 @@ int main(int argc, char** argv) {
             imageio_write_png(filename_image, img, false);
         }
     }
+    auto render_time = render_timer.elapsed();
+    intersect_shadow_stats_flush();
+    auto stats = intersect_shadow_stats();
+    printf("Render: %.3fs\n", render_time);
+    if(pathtrace) printf("Paths: %d (%.3f Mpaths/s, %s)\n", w*h*samples, w*h*samples / (render_time * 1e6),
+                         (pathtrace_opts.bidirectional) ? "bidirectional" : ((pathtrace_opts.wavefront) ? "wavefront" : "megakernel"));
+    auto photon_maps = (pathtrace) ? pathtrace_opts._photons : ((distribution) ? disttrace_opts._photons : nullptr);
+    if(photon_maps) printf("Photons: %d emitted, %d stored, %d caustic\n", photon_maps->emitted,
+                           (int)photon_maps->global.photons.size(), (int)photon_maps->caustic.photons.size());
+    if(stats.rays) printf("Shadow rays: %lld (%.2f Mrays/s), occluded: %.1f%%, occluder cache hits: %.1f%%\n",
+                          stats.rays, stats.rays / (render_time * 1e6), 100.0 * stats.occluded / stats.rays,
+                          (stats.occluded) ? 100.0 * stats.cache_hits / stats.occluded : 0.0);
+    texture_cache_stats_flush();
+    auto cstats = texture_cache_stats();
+    if(cstats.lookups) printf("Texture cache: %lld lookups, hit rate %.2f%% (%.2f%% per-thread), %lld misses, %lld evictions, peak %.1f MB\n",
+                              cstats.lookups, 100.0 * (cstats.lookups - cstats.misses) / cstats.lookups,
+                              100.0 * cstats.thread_hits / cstats.lookups, cstats.misses, cstats.evictions, cstats.peak_bytes / 1048576.0);
     trace_image_buffer.get_image(img);
+    if(print_mean) {
+        auto mean = zero3f;
+        for(auto& c : img) mean += c;
+        mean /= img.width() * img.height();
+        printf("Mean: %f %f %f\n", mean.x, mean.y, mean.z);
+    }
     imageio_write_png(filename_image, img, false);
 }
 
@@ -113,7 +113,7 @@ void trace_progressive_pass() {
     trace_sync_opts();
     
     if(trace_distributed) PUT_YOUR_CODE_HERE("Distribution Raytracing");
-    else if(trace_path) PUT_YOUR_CODE_HERE("Pathtracing");
+    else if(trace_path) pathtrace_scene_progressive(trace_image_buffer, scene, trace_path_opts);
     else raytrace_scene_progressive(trace_image_buffer, scene, trace_opts);
     
     trace_image_buffer.get_image(trace_img);
@@ -224,6 +224,38 @@ void selection_subelement_next(bool forward) {
     selected_point = &pos->at(selected_subelement);
 }
 
+/// refit the scene accelerator to the edited selection (lights are not in the accelerator)
+void selection_accelerator_update() {
+    if(not trace) return;
+    if(selected_element < 0 or selected_element >= scene->prims->prims.size()) return;
+    intersect_scene_update(scene, selected_element);
+}
+
+/// re-register the emitters and re-init light sampling if the edited selection is a light or an emissive surface
+/// (emitters copy the frame of their surface, and light selection caches the light positions and powers)
+void selection_lights_update() {
+    if(not trace) return;
+    auto nprims = scene->prims->prims.size();
+    if(selected_element < 0 or selected_element >= nprims + scene->lights->lights.size()) return;
+    if(selected_element < nprims) {
+        auto prim = scene->prims->prims[selected_element];
+        auto emissive = prim->material and is<LambertEmission>(prim->material) and not (cast<LambertEmission>(prim->material)->emission == zero3f);
+        auto arealight = false;
+        if(is<Surface>(prim)) for(auto light : scene->lights->lights) arealight = arealight or (is<AreaLight>(light) and cast<AreaLight>(light)->shape == cast<Surface>(prim)->shape);
+        if(not emissive and not arealight) return;
+    }
+    scene_emitters_init(scene);
+    sample_lights_init(scene->lights);
+    // emitters are recreated in the same order, so a selected light keeps its index
+    if(selected_element >= nprims) selected_frame = &scene->lights->lights[selected_element - nprims]->frame;
+}
+
+/// drop the photon maps, which do not follow scene edits, so that the next pass traces them again
+void selection_photons_clear() {
+    trace_path_opts._photons = nullptr;
+    trace_distributed_opts._photons = nullptr;
+}
+
 /// move selection
 void selection_move(const vec3f& t) {
     if(selected_point) {
@@ -234,6 +266,9 @@ void selection_move(const vec3f& t) {
         //}
     }
     else if(selected_frame) selected_frame->o += transform_vector(*selected_frame,t);
+    selection_accelerator_update();
+    selection_lights_update();
+    selection_photons_clear();
     trace_updated = true;
 }
 
@@ -248,6 +283,9 @@ void selection_rotate(const vec3f& ea) {
                  translation_matrix(- selected_frame->o);
         *selected_frame = transform_frame(m, *selected_frame);
     }
+    selection_accelerator_update();
+    selection_lights_update();
+    selection_photons_clear();
     trace_updated = true;
 }
 
@@ -263,13 +301,15 @@ void init() {
     if(scene->pathtrace_opts) trace_path_opts = *scene->pathtrace_opts;
 
     selection_element_clear();
+    selection_photons_clear();
     if(trace) {
         trace_init_res();
         //if(accelerate_scene) {
-            scene->prims->intersect_accelerator_use = false;
             intersect_scene_accelerate(scene);
         //}
+        scene_emitters_init(scene);
         sample_lights_init(scene->lights);
+        scene_materials_init(scene);
     }
     trace_updated = true;
 }
@@ -7,6 +7,7 @@
 #include <tuple>
 #include <array>
 #include <functional>
+#include <memory>
 
 ///@file common/std.h Brings std functionality. @ingroup common
 
@@ -29,6 +30,9 @@ using std::tuple;
 using std::make_tuple;
 using std::get;
 
+using std::shared_ptr;
+using std::make_shared;
+
 //using std::static_pointer_cast;  //< are these used? gcc-4.7 does not recognize
 //using std::dynamic_pointer_cast;
 
@@ -1,36 +1,51 @@
 #include "accelerator.h"
+#include <cstdio>
 
 ///@file igl/accelerator.cpp Intersection Accelerators. @ingroup igl
 
 struct _BVHBoxedPrim { int i; range3f bbox; vec3f center; };
 
-bool intersect_bvhnode_first(BVHAccelerator* bvh, int nodeid, const ray3f& ray, intersection3f& intersection) {
+// fills the sorted indices of a leaf to be tested, culled if the accelerator has a leaf kernel
+int intersect_bvhnode_leaf_candidates(BVHAccelerator* bvh, const BVHNode& node, const ray3f& ray, int* candidates) {
+    if(bvh->_intersect_leaf_cull) return bvh->_intersect_leaf_cull(node.start, node.end, ray, candidates);
+    for(auto idx : range(node.start,node.end)) candidates[idx-node.start] = idx;
+    return node.end-node.start;
+}
+
+// closest hit in the subtree of nodeid, returning its element in elementid; hits at the same distance go to the
+// lowest element, so that the result does not depend on the tree (or on the accelerator type)
+bool intersect_bvhnode_first(BVHAccelerator* bvh, int nodeid, const ray3f& ray, intersection3f& intersection, int& elementid) {
     auto& node = bvh->nodes[nodeid];
     if(not intersect_bbox(ray, node.bbox)) return false;
     bool hit = false; float mint = ray3f::rayinf;
     ray3f sray = ray;
     if(node.leaf) {
-        for(auto idx : range(node.start,node.end)) {
-            auto i = bvh->sorted_prims[idx];
+        int candidates[BVHAccelerator::min_prims];
+        auto ncandidates = intersect_bvhnode_leaf_candidates(bvh, node, sray, candidates);
+        for(auto c : range(ncandidates)) {
+            auto i = bvh->sorted_prims[candidates[c]];
             intersection3f sintersection;
             if(bvh->_intersect_elem_first(i, sray, sintersection)) {
-                if(mint > sintersection.ray_t) {
+                if(mint > sintersection.ray_t or (mint == sintersection.ray_t and i < elementid)) {
                     hit = true;
                     mint = sintersection.ray_t;
                     sray.tmax = mint;
                     intersection = sintersection;
+                    elementid = i;
                 }
             }
         }
     } else {
         for(auto n : { node.n0, node.n1 }) {
             intersection3f sintersection;
-            if(intersect_bvhnode_first(bvh, n, sray, sintersection)) {
-                if(mint > sintersection.ray_t) {
+            int selementid = -1;
+            if(intersect_bvhnode_first(bvh, n, sray, sintersection, selementid)) {
+                if(mint > sintersection.ray_t or (mint == sintersection.ray_t and selementid < elementid)) {
                     hit = true;
                     mint = sintersection.ray_t;
                     sray.tmax = mint;
                     intersection = sintersection;
+                    elementid = selementid;
                 }
             }
         }
@@ -39,30 +54,40 @@ bool intersect_bvhnode_first(BVHAccelerator* bvh, int nodeid, const ray3f& ray,
 }
 
 bool intersect_bvh_first(BVHAccelerator* bvh, const ray3f& ray, intersection3f& intersection) {
-    return intersect_bvhnode_first(bvh, 0, ray, intersection);
+    int elementid = -1;
+    return intersect_bvhnode_first(bvh, 0, ray, intersection, elementid);
 }
 
-bool intersect_bvhnode_any(BVHAccelerator* bvh, int nodeid, const ray3f& ray) {
-    auto& node = bvh->nodes[nodeid];
-    if(not intersect_bbox(ray, node.bbox)) return false;
-    if(node.leaf) {
-        for(auto idx : range(node.start,node.end)) {
-            auto i = bvh->sorted_prims[idx];
-            if(bvh->_intersect_elem_any(i,ray)) return true;
+// iterative traversal that stops at the first hit, visiting first the child nearer along the split axis
+bool intersect_bvh_any(BVHAccelerator* bvh, const ray3f& ray, int& elementid) {
+    int stack[BVHAccelerator::max_depth*2]; int nstack = 0;
+    stack[nstack++] = 0;
+    while(nstack) {
+        auto& node = bvh->nodes[stack[--nstack]];
+        if(not intersect_bbox(ray, node.bbox)) continue;
+        if(node.leaf) {
+            int candidates[BVHAccelerator::min_prims];
+            auto ncandidates = intersect_bvhnode_leaf_candidates(bvh, node, ray, candidates);
+            for(auto c : range(ncandidates)) {
+                auto i = bvh->sorted_prims[candidates[c]];
+                if(bvh->_intersect_elem_any(i,ray)) { elementid = i; return true; }
+            }
+        } else {
+            if(ray.d[node.axis] >= 0) { stack[nstack++] = node.n1; stack[nstack++] = node.n0; }
+            else { stack[nstack++] = node.n0; stack[nstack++] = node.n1; }
         }
-    } else {
-        if(intersect_bvhnode_any(bvh,node.n0,ray)) return true;
-        if(intersect_bvhnode_any(bvh,node.n1,ray)) return true;
     }
     return false;
 }
 
 bool intersect_bvh_any(BVHAccelerator* bvh, const ray3f& ray) {
-    return intersect_bvhnode_any(bvh, 0, ray);
+    int elementid;
+    return intersect_bvh_any(bvh, ray, elementid);
 }
 
-int intersect_bvh_build_split(BVHAccelerator* bvh, vector<_BVHBoxedPrim>& prim, int start, int end, const range3f& bbox) {
+int intersect_bvh_build_split(BVHAccelerator* bvh, vector<_BVHBoxedPrim>& prim, int start, int end, const range3f& bbox, unsigned char& axis) {
     vec3f d = size(bbox);
+    axis = (d.x > d.y and d.x > d.z) ? 0 : ((d.y > d.z) ? 1 : 2);
     if(d.x > d.y and d.x > d.z) {
         std::sort(prim.begin()+start,prim.begin()+end,
                   [](const _BVHBoxedPrim& i, const _BVHBoxedPrim& j) { return i.center.x < j.center.x; });
@@ -86,7 +111,7 @@ void intersect_bvh_build_node(BVHAccelerator* bvh, int nodeid, vector<_BVHBoxedP
         node.start = start;
         node.end = end;
     } else {
-        int middle = intersect_bvh_build_split(bvh,prim,start,end,bbox);
+        int middle = intersect_bvh_build_split(bvh,prim,start,end,bbox,node.axis);
         node.bbox = bbox;
         node.leaf = false;
         bvh->nodes.push_back(BVHNode());
@@ -100,6 +125,75 @@ void intersect_bvh_build_node(BVHAccelerator* bvh, int nodeid, vector<_BVHBoxedP
     bvh->nodes[nodeid] = node;
 }
 
+string BVHAccelerator::cache_dir = "";
+
+const unsigned int _bvh_cache_magic = 0x48564231; // "1BVH"
+const unsigned int _bvh_cache_version = 2;
+
+struct _BVHCacheHeader { unsigned int magic, version, node_size; int elem_num, node_num; unsigned long long key; };
+
+// fnv-1a over raw bytes
+unsigned long long _bvh_cache_hash(unsigned long long h, const void* data, size_t size) {
+    auto bytes = (const unsigned char*)data;
+    for(auto i : range(size)) { h ^= bytes[i]; h *= 1099511628211ull; }
+    return h;
+}
+
+// the build only depends on element bounds and build parameters, so these make the key
+unsigned long long intersect_bvh_cache_key(const vector<_BVHBoxedPrim>& prims) {
+    unsigned long long h = 14695981039346656037ull;
+    int params[] = { (int)_bvh_cache_version, BVHAccelerator::min_prims, (int)sizeof(BVHNode), (int)prims.size() };
+    float eps = BVHAccelerator::epsilon;
+    h = _bvh_cache_hash(h, params, sizeof(params));
+    h = _bvh_cache_hash(h, &eps, sizeof(eps));
+    for(auto& prim : prims) h = _bvh_cache_hash(h, &prim.bbox, sizeof(prim.bbox));
+    return h;
+}
+
+string intersect_bvh_cache_filename(unsigned long long key) {
+    char buf[64]; sprintf(buf, "bvh_%016llx.bvhcache", key);
+    return BVHAccelerator::cache_dir + "/" + buf;
+}
+
+bool intersect_bvh_cache_read(BVHAccelerator* bvh, unsigned long long key) {
+    auto f = fopen(intersect_bvh_cache_filename(key).c_str(), "rb");
+    if(not f) return false;
+    auto header = _BVHCacheHeader();
+    bool ok = fread(&header, sizeof(header), 1, f) == 1 and
+              header.magic == _bvh_cache_magic and header.version == _bvh_cache_version and
+              header.node_size == sizeof(BVHNode) and header.elem_num == bvh->_intersect_elem_num and
+              header.key == key and header.node_num > 0;
+    if(ok) {
+        bvh->nodes.resize(header.node_num);
+        bvh->sorted_prims.resize(header.elem_num);
+        ok = fread(bvh->nodes.data(), sizeof(BVHNode), header.node_num, f) == header.node_num and
+             fread(bvh->sorted_prims.data(), sizeof(int), header.elem_num, f) == header.elem_num;
+    }
+    fclose(f);
+    if(not ok) {
+        WARNING("corrupted bvh cache %s, rebuilding", intersect_bvh_cache_filename(key).c_str());
+        bvh->nodes.clear();
+        bvh->sorted_prims.clear();
+    }
+    return ok;
+}
+
+void intersect_bvh_cache_write(BVHAccelerator* bvh, unsigned long long key) {
+    auto filename = intersect_bvh_cache_filename(key);
+    // write to a temporary and rename so concurrent renders never read partial files
+    auto tmpname = filename + ".tmp";
+    auto f = fopen(tmpname.c_str(), "wb");
+    if(not f) { WARNING("cannot write bvh cache %s", filename.c_str()); return; }
+    auto header = _BVHCacheHeader{ _bvh_cache_magic, _bvh_cache_version, (unsigned int)sizeof(BVHNode),
+                                   bvh->_intersect_elem_num, (int)bvh->nodes.size(), key };
+    bool ok = fwrite(&header, sizeof(header), 1, f) == 1 and
+              fwrite(bvh->nodes.data(), sizeof(BVHNode), bvh->nodes.size(), f) == bvh->nodes.size() and
+              fwrite(bvh->sorted_prims.data(), sizeof(int), bvh->sorted_prims.size(), f) == bvh->sorted_prims.size();
+    fclose(f);
+    if(ok) ok = rename(tmpname.c_str(), filename.c_str()) == 0;
+    if(not ok) { WARNING("cannot write bvh cache %s", filename.c_str()); remove(tmpname.c_str()); }
+}
+
 void intersect_bvh_accelerate(BVHAccelerator* bvh)  {
     vector<_BVHBoxedPrim> prims(bvh->_intersect_elem_num);
     for(auto i : range(prims.size())) {
@@ -108,13 +202,319 @@ void intersect_bvh_accelerate(BVHAccelerator* bvh)  {
         prims[i].bbox = rscale(prims[i].bbox,1+BVHAccelerator::epsilon);
         prims[i].center = center(prims[i].bbox);
     }
+    bool cached = not BVHAccelerator::cache_dir.empty() and prims.size() >= BVHAccelerator::cache_min_elems;
+    auto key = (cached) ? intersect_bvh_cache_key(prims) : 0ull;
+    if(cached and intersect_bvh_cache_read(bvh, key)) return;
     bvh->nodes.push_back(BVHNode());
     intersect_bvh_build_node(bvh,0,prims,0,prims.size());
     bvh->sorted_prims.resize(prims.size());
     for(auto i : range(prims.size())) bvh->sorted_prims[i] = prims[i].i;
+    if(cached) intersect_bvh_cache_write(bvh, key);
 }
 
 range3f intersect_bvh_bounds(BVHAccelerator* bvh) {
     return bvh->nodes[0].bbox;
 }
 
+// node surface area, used to measure the tree degradation on updates
+inline float _bvh_node_area(const range3f& bbox) {
+    auto d = size(bbox);
+    return 2*(d.x*d.y+d.y*d.z+d.z*d.x);
+}
+
+// sets parents, element leaves and reference areas for the subtree at nodeid
+void intersect_bvh_update_init_node(BVHAccelerator* bvh, int nodeid, int parent) {
+    auto& node = bvh->nodes[nodeid];
+    bvh->_update_parent[nodeid] = parent;
+    bvh->_update_area[nodeid] = _bvh_node_area(node.bbox);
+    if(node.leaf) {
+        for(auto idx : range(node.start,node.end)) bvh->_update_leaf[bvh->sorted_prims[idx]] = nodeid;
+    } else {
+        intersect_bvh_update_init_node(bvh,node.n0,nodeid);
+        intersect_bvh_update_init_node(bvh,node.n1,nodeid);
+    }
+}
+
+void intersect_bvh_update_init(BVHAccelerator* bvh) {
+    bvh->_update_parent.assign(bvh->nodes.size(),-1);
+    bvh->_update_area.assign(bvh->nodes.size(),0);
+    bvh->_update_leaf.assign(bvh->_intersect_elem_num,-1);
+    bvh->_update_unused = 0;
+    intersect_bvh_update_init_node(bvh,0,-1);
+}
+
+// rebuilds the subtree at nodeid in place over its range of sorted primitives (new nodes are appended)
+void intersect_bvh_update_rebuild(BVHAccelerator* bvh, int nodeid) {
+    auto first = nodeid, last = nodeid;
+    while(not bvh->nodes[first].leaf) first = bvh->nodes[first].n0;
+    while(not bvh->nodes[last].leaf) last = bvh->nodes[last].n1;
+    auto start = bvh->nodes[first].start, end = bvh->nodes[last].end;
+    int stack[BVHAccelerator::max_depth*2]; int nstack = 0;
+    stack[nstack++] = nodeid;
+    while(nstack) {
+        auto& node = bvh->nodes[stack[--nstack]];
+        if(node.leaf) continue;
+        stack[nstack++] = node.n0; stack[nstack++] = node.n1;
+        bvh->_update_unused += 3;
+    }
+    vector<_BVHBoxedPrim> prims(end-start);
+    for(auto i : range(prims.size())) {
+        prims[i].i = bvh->sorted_prims[start+i];
+        prims[i].bbox = rscale(bvh->_intersect_elem_bounds(prims[i].i),1+BVHAccelerator::epsilon);
+        prims[i].center = center(prims[i].bbox);
+    }
+    auto nnodes = bvh->nodes.size();
+    intersect_bvh_build_node(bvh,nodeid,prims,0,prims.size());
+    for(auto i : range(prims.size())) bvh->sorted_prims[start+i] = prims[i].i;
+    if(bvh->nodes[nodeid].leaf) { bvh->nodes[nodeid].start += start; bvh->nodes[nodeid].end += start; }
+    for(auto n : range(nnodes,bvh->nodes.size())) {
+        if(bvh->nodes[n].leaf) { bvh->nodes[n].start += start; bvh->nodes[n].end += start; }
+    }
+    bvh->_update_parent.resize(bvh->nodes.size(),-1);
+    bvh->_update_area.resize(bvh->nodes.size(),0);
+    intersect_bvh_update_init_node(bvh,nodeid,bvh->_update_parent[nodeid]);
+}
+
+// refits the path from the element leaf to the root; rebuilds the highest degraded subtree
+void intersect_bvh_update(BVHAccelerator* bvh, int elementid) {
+    if(bvh->_update_parent.empty()) intersect_bvh_update_init(bvh);
+    auto rebuildid = -1;
+    for(auto nodeid = bvh->_update_leaf[elementid]; nodeid >= 0; nodeid = bvh->_update_parent[nodeid]) {
+        auto& node = bvh->nodes[nodeid];
+        range3f bbox;
+        if(node.leaf) {
+            for(auto idx : range(node.start,node.end))
+                bbox = runion(bbox,rscale(bvh->_intersect_elem_bounds(bvh->sorted_prims[idx]),1+BVHAccelerator::epsilon));
+        } else {
+            bbox = runion(bvh->nodes[node.n0].bbox,bvh->nodes[node.n1].bbox);
+            if(_bvh_node_area(bbox) > BVHAccelerator::update_rebuild_ratio*bvh->_update_area[nodeid]) rebuildid = nodeid;
+        }
+        node.bbox = bbox;
+    }
+    if(rebuildid < 0) return;
+    // rebuilds reorder the sorted primitives, so leaf culling data is stale
+    bvh->_intersect_leaf_cull = nullptr;
+    if(rebuildid == 0 or bvh->_update_unused > bvh->nodes.size()/2) {
+        bvh->nodes.clear();
+        bvh->sorted_prims.clear();
+        bvh->_update_parent.clear();
+        intersect_bvh_accelerate(bvh);
+    } else intersect_bvh_update_rebuild(bvh,rebuildid);
+}
+
+
+// grid cell index of a point along an axis, clamped to the grid
+inline int _grid_cell_coord(const GridCells& cells, const vec3f& p, int axis) {
+    return clamp(int((p[axis]-cells.bbox.min[axis])/cells.cell_size[axis]),0,cells.res[axis]-1);
+}
+
+inline int _grid_cell_index(const GridCells& cells, const vec3i& idx) {
+    return (idx.z*cells.res.y+idx.y)*cells.res.x+idx.x;
+}
+
+// bins the elements into a uniform grid over bbox, with about density cells per element
+void intersect_grid_build_cells(GridCells& cells, const vector<range3f>& bounds, const vector<int>& elems, const range3f& bbox, float density) {
+    auto size = bbox.max - bbox.min;
+    auto maxsize = max(max(size.x,size.y),size.z);
+    // pad degenerate axes so that every cell has a positive size
+    auto pad = vec3f(maxsize*1e-4f+Accelerator::epsilon,maxsize*1e-4f+Accelerator::epsilon,maxsize*1e-4f+Accelerator::epsilon);
+    cells.bbox = range3f(bbox.min-pad,bbox.max+pad);
+    size = cells.bbox.max - cells.bbox.min;
+    maxsize = max(max(size.x,size.y),size.z);
+    auto cells_per_unit = pow(density*elems.size(),1/3.0f) / maxsize;
+    for(auto i : range(3)) {
+        cells.res[i] = clamp(int(size[i]*cells_per_unit),1,GridAccelerator::max_res);
+        cells.cell_size[i] = size[i] / cells.res[i];
+    }
+    auto ncells = cells.res.x*cells.res.y*cells.res.z;
+    // count elements per cell, then fill in a second pass
+    cells.cell_start.assign(ncells+1,0);
+    for(auto pass : range(2)) {
+        vector<int> fill;
+        if(pass) {
+            for(auto c : range(ncells)) cells.cell_start[c+1] += cells.cell_start[c];
+            cells.cell_elems.resize(cells.cell_start[ncells]);
+            fill.assign(cells.cell_start.begin(),cells.cell_start.end()-1);
+        }
+        for(auto e : elems) {
+            auto& ebbox = bounds[e];
+            vec3i lo, hi;
+            for(auto i : range(3)) { lo[i] = _grid_cell_coord(cells,ebbox.min,i); hi[i] = _grid_cell_coord(cells,ebbox.max,i); }
+            for(auto z : range(lo.z,hi.z+1)) for(auto y : range(lo.y,hi.y+1)) for(auto x : range(lo.x,hi.x+1)) {
+                auto c = _grid_cell_index(cells,vec3i(x,y,z));
+                if(pass) cells.cell_elems[fill[c]++] = e;
+                else cells.cell_start[c+1]++;
+            }
+        }
+    }
+}
+
+void intersect_grid_accelerate(GridAccelerator* grid) {
+    vector<range3f> bounds(grid->_intersect_elem_num);
+    vector<int> elems(grid->_intersect_elem_num);
+    range3f bbox;
+    for(auto i : range(bounds.size())) {
+        bounds[i] = rscale(grid->_intersect_elem_bounds(i),1+Accelerator::epsilon);
+        elems[i] = i;
+        bbox = runion(bbox,bounds[i]);
+    }
+    intersect_grid_build_cells(grid->top,bounds,elems,bbox,GridAccelerator::top_density);
+    // refine dense cells with a nested grid over the cell
+    auto& top = grid->top;
+    top.cell_grid.assign(top.cell_start.size()-1,-1);
+    for(auto z : range(top.res.z)) for(auto y : range(top.res.y)) for(auto x : range(top.res.x)) {
+        auto c = _grid_cell_index(top,vec3i(x,y,z));
+        if(top.cell_start[c+1]-top.cell_start[c] < GridAccelerator::refine_min_elems) continue;
+        auto cmin = top.bbox.min + vec3f(x,y,z)*top.cell_size;
+        auto cell_elems = vector<int>(top.cell_elems.begin()+top.cell_start[c],top.cell_elems.begin()+top.cell_start[c+1]);
+        top.cell_grid[c] = grid->cells.size();
+        grid->cells.push_back(GridCells());
+        intersect_grid_build_cells(grid->cells.back(),bounds,cell_elems,range3f(cmin,cmin+top.cell_size),GridAccelerator::cell_density);
+    }
+}
+
+// grids are cheap to build, so updates rebuild the whole grid
+void intersect_grid_update(GridAccelerator* grid, int elementid) {
+    grid->top = GridCells();
+    grid->cells.clear();
+    intersect_grid_accelerate(grid);
+}
+
+range3f intersect_grid_bounds(GridAccelerator* grid) {
+    return grid->top.bbox;
+}
+
+// 3D-DDA over the cells crossed by the ray in [t0,t1], calling visit(cell,tenter,texit) until it returns true
+template<typename Visit>
+bool _intersect_grid_traverse(const GridCells& cells, const ray3f& ray, float t0, float t1, const Visit& visit) {
+    auto p = ray.eval(t0);
+    vec3i idx, step, out; vec3f tnext, tdelta;
+    for(auto i : range(3)) {
+        idx[i] = _grid_cell_coord(cells,p,i);
+        if(ray.d[i] > 0) {
+            step[i] = 1; out[i] = cells.res[i];
+            tnext[i] = (cells.bbox.min[i]+(idx[i]+1)*cells.cell_size[i]-ray.e[i]) / ray.d[i];
+            tdelta[i] = cells.cell_size[i] / ray.d[i];
+        } else if(ray.d[i] < 0) {
+            step[i] = -1; out[i] = -1;
+            tnext[i] = (cells.bbox.min[i]+idx[i]*cells.cell_size[i]-ray.e[i]) / ray.d[i];
+            tdelta[i] = -cells.cell_size[i] / ray.d[i];
+        } else {
+            step[i] = 0; out[i] = -1;
+            tnext[i] = ray3f::rayinf; tdelta[i] = ray3f::rayinf;
+        }
+    }
+    auto tenter = t0;
+    while(true) {
+        auto axis = (tnext.x < tnext.y) ? ((tnext.x < tnext.z) ? 0 : 2) : ((tnext.y < tnext.z) ? 1 : 2);
+        auto texit = min(tnext[axis],t1);
+        if(visit(_grid_cell_index(cells,idx),tenter,texit)) return true;
+        if(not (tnext[axis] <= t1)) return false; // also stops degenerate (nan) rays
+        idx[axis] += step[axis];
+        if(idx[axis] == out[axis]) return false;
+        tenter = tnext[axis];
+        tnext[axis] += tdelta[axis];
+    }
+}
+
+bool intersect_grid_first(GridAccelerator* grid, const ray3f& ray, intersection3f& intersection) {
+    float t0, t1;
+    if(not intersect_bbox(ray, grid->top.bbox, t0, t1)) return false;
+    bool hit = false;
+    int elementid = -1;
+    ray3f sray = ray;
+    // tests the elements of a cell, keeping the lowest element among hits at the same distance as the bvh does;
+    // elements straddle cells, so the traversal stops only once the closest hit lies strictly before the cell
+    // exit, where no later cell can hold a closer (or tied) hit
+    auto visit_cells = [&](const GridCells& cells, int c, float texit) {
+        for(auto e : range(cells.cell_start[c],cells.cell_start[c+1])) {
+            auto i = cells.cell_elems[e];
+            if(i == elementid) continue;
+            intersection3f sintersection;
+            if(grid->_intersect_elem_first(i, sray, sintersection)) {
+                if(sray.tmax > sintersection.ray_t or (sray.tmax == sintersection.ray_t and (not hit or i < elementid))) {
+                    hit = true;
+                    sray.tmax = sintersection.ray_t;
+                    intersection = sintersection;
+                    elementid = i;
+                }
+            }
+        }
+        return hit and sray.tmax < texit;
+    };
+    _intersect_grid_traverse(grid->top, ray, t0, t1, [&](int c, float tenter, float texit) {
+        auto g = grid->top.cell_grid[c];
+        if(g < 0) return visit_cells(grid->top, c, texit);
+        auto& cells = grid->cells[g];
+        _intersect_grid_traverse(cells, ray, tenter, min(texit,sray.tmax), [&](int sc, float, float stexit) {
+            return visit_cells(cells, sc, stexit);
+        });
+        return hit and sray.tmax < texit;
+    });
+    return hit;
+}
+
+bool intersect_grid_any(GridAccelerator* grid, const ray3f& ray, int& elementid) {
+    float t0, t1;
+    if(not intersect_bbox(ray, grid->top.bbox, t0, t1)) return false;
+    auto visit_cells = [&](const GridCells& cells, int c) {
+        for(auto e : range(cells.cell_start[c],cells.cell_start[c+1])) {
+            auto i = cells.cell_elems[e];
+            if(grid->_intersect_elem_any(i,ray)) { elementid = i; return true; }
+        }
+        return false;
+    };
+    return _intersect_grid_traverse(grid->top, ray, t0, t1, [&](int c, float tenter, float texit) {
+        auto g = grid->top.cell_grid[c];
+        if(g < 0) return visit_cells(grid->top, c);
+        auto& cells = grid->cells[g];
+        return _intersect_grid_traverse(cells, ray, tenter, texit, [&](int sc, float, float) {
+            return visit_cells(cells, sc);
+        });
+    });
+}
+
+Accelerator* intersect_accelerator_new(const string& type, int intersect_elem_num,
+                                       const function<range3f (int)> intersect_elem_bounds,
+                                       const function<bool (int,const ray3f&,intersection3f&)> intersect_elem_first,
+                                       const function<bool (int,const ray3f&)> intersect_elem_any) {
+    if(type == "bvh") return new BVHAccelerator(intersect_elem_num,intersect_elem_bounds,intersect_elem_first,intersect_elem_any);
+    else if(type == "grid") return new GridAccelerator(intersect_elem_num,intersect_elem_bounds,intersect_elem_first,intersect_elem_any);
+    else { ERROR("unknown accelerator type %s", type.c_str()); return nullptr; }
+}
+
+void intersect_accelerator_build(Accelerator* accelerator) {
+    if(is<BVHAccelerator>(accelerator)) intersect_bvh_accelerate(cast<BVHAccelerator>(accelerator));
+    else if(is<GridAccelerator>(accelerator)) intersect_grid_accelerate(cast<GridAccelerator>(accelerator));
+    else NOT_IMPLEMENTED_ERROR();
+}
+
+range3f intersect_accelerator_bounds(Accelerator* accelerator) {
+    if(is<BVHAccelerator>(accelerator)) return intersect_bvh_bounds(cast<BVHAccelerator>(accelerator));
+    else if(is<GridAccelerator>(accelerator)) return intersect_grid_bounds(cast<GridAccelerator>(accelerator));
+    else { NOT_IMPLEMENTED_ERROR(); return range3f(); }
+}
+
+bool intersect_accelerator_first(Accelerator* accelerator, const ray3f& ray, intersection3f& intersection) {
+    if(is<BVHAccelerator>(accelerator)) return intersect_bvh_first(cast<BVHAccelerator>(accelerator),ray,intersection);
+    else if(is<GridAccelerator>(accelerator)) return intersect_grid_first(cast<GridAccelerator>(accelerator),ray,intersection);
+    else { NOT_IMPLEMENTED_ERROR(); return false; }
+}
+
+bool intersect_accelerator_any(Accelerator* accelerator, const ray3f& ray, int& elementid) {
+    if(is<BVHAccelerator>(accelerator)) return intersect_bvh_any(cast<BVHAccelerator>(accelerator),ray,elementid);
+    else if(is<GridAccelerator>(accelerator)) return intersect_grid_any(cast<GridAccelerator>(accelerator),ray,elementid);
+    else { NOT_IMPLEMENTED_ERROR(); return false; }
+}
+
+bool intersect_accelerator_any(Accelerator* accelerator, const ray3f& ray) {
+    int elementid;
+    return intersect_accelerator_any(accelerator, ray, elementid);
+}
+
+void intersect_accelerator_update(Accelerator* accelerator, int elementid) {
+    if(accelerator->_intersect_elem_update) accelerator->_intersect_elem_update(elementid);
+    if(is<BVHAccelerator>(accelerator)) intersect_bvh_update(cast<BVHAccelerator>(accelerator),elementid);
+    else if(is<GridAccelerator>(accelerator)) intersect_grid_update(cast<GridAccelerator>(accelerator),elementid);
+    else NOT_IMPLEMENTED_ERROR();
+}
@@ -13,6 +13,7 @@
 /// BVH node
 struct BVHNode {
     bool leaf; ///< leaf node
+    unsigned char axis; ///< for internal: split axis (left child has the smaller centers)
     range3f bbox; ///< bounding box
     union {
         struct { int start, end; }; ///< for leaves: start and end primitive
@@ -20,38 +21,115 @@ struct BVHNode {
     };
 };
 
-/// Bounding Volume Accelerator
-struct BVHAccelerator {
-    static const int                    min_prims = 4; ///< min primitives
+/// Abstract Intersection Accelerator over indexed elements
+struct Accelerator : Node {
+    REGISTER_FAST_RTTI(Node,Accelerator,11)
+    
     constexpr static const float        epsilon = ray3f::epsilon; ///< epsilon
     
-    int                                                 _intersect_elem_num; ///< number of elements
+    int                                                 _intersect_elem_num = 0; ///< number of elements
     function<range3f (int)>                             _intersect_elem_bounds; ///< function for element bounds
     function<bool (int,const ray3f&,intersection3f&)>   _intersect_elem_first; ///< function for element first intersection
     function<bool (int,const ray3f&)>                   _intersect_elem_any; ///< function for element any intersection
+    function<void (int)>                                _intersect_elem_update; ///< optional function to refresh cached element data on updates
+    
+    /// Constructor (sets element number and functions)
+    Accelerator(int intersect_elem_num,
+                const function<range3f (int)> intersect_elem_bounds,
+                const function<bool (int,const ray3f&,intersection3f&)> intersect_elem_first,
+                const function<bool (int,const ray3f&)> intersect_elem_any) :
+                    _intersect_elem_num(intersect_elem_num),
+                    _intersect_elem_bounds(intersect_elem_bounds),
+                    _intersect_elem_first(intersect_elem_first),
+                    _intersect_elem_any(intersect_elem_any) { _tid = _typeuid; }
+};
+
+/// Bounding Volume Accelerator
+struct BVHAccelerator : Accelerator {
+    REGISTER_FAST_RTTI(Accelerator,BVHAccelerator,1)
+    
+    static const int                    min_prims = 4; ///< min primitives
+    
+    static string                       cache_dir; ///< directory for cached builds (empty to disable caching)
+    static const int                    cache_min_elems = 1024; ///< min elements for a build to be cached
+    static const int                    max_depth = 64; ///< max tree depth (traversal stack size)
+    constexpr static const float        update_rebuild_ratio = 2; ///< on updates, rebuild the subtree of nodes whose area grew by this factor
+    
+    function<int (int,int,const ray3f&,int*)>           _intersect_leaf_cull; ///< optional leaf culling: writes the sorted indices in [start,end) that may be hit and returns their number
     
     vector<int>                         sorted_prims; ///< sorted primitives
     vector<BVHNode>                     nodes; ///< bvh nodes
     
+    vector<int>                         _update_parent; ///< node parents (-1 for root and unused nodes), set on the first update
+    vector<int>                         _update_leaf; ///< element leaves, set on the first update
+    vector<float>                       _update_area; ///< node areas at build time, set on the first update
+    int                                 _update_unused = 0; ///< nodes left unused by subtree rebuilds
+    
     /// Constructor (sets element number and functions)
     BVHAccelerator(int intersect_elem_num,
                    const function<range3f (int)> intersect_elem_bounds,
                    const function<bool (int,const ray3f&,intersection3f&)> intersect_elem_first,
                    const function<bool (int,const ray3f&)> intersect_elem_any) :
-                    _intersect_elem_num(intersect_elem_num),
-                    _intersect_elem_bounds(intersect_elem_bounds),
-                    _intersect_elem_first(intersect_elem_first),
-                    _intersect_elem_any(intersect_elem_any) { }
+                    Accelerator(intersect_elem_num, intersect_elem_bounds, intersect_elem_first, intersect_elem_any) { _tid = _typeuid; }
     /// Copy constructor
     BVHAccelerator(const BVHAccelerator& bvh) = default;    
 };
 
+/// Uniform grid cells with their overlapping elements
+struct GridCells {
+    range3f                             bbox; ///< grid bounds
+    vec3i                               res = zero3i; ///< grid resolution
+    vec3f                               cell_size = zero3f; ///< cell size
+    vector<int>                         cell_start; ///< per-cell start into cell_elems (one more than the cells)
+    vector<int>                         cell_elems; ///< elements overlapping each cell
+    vector<int>                         cell_grid; ///< per-cell refinement grid (-1 for none, top level only)
+};
+
+/// Two-level Uniform Grid Accelerator (dense cells are refined by a nested grid)
+struct GridAccelerator : Accelerator {
+    REGISTER_FAST_RTTI(Accelerator,GridAccelerator,2)
+    
+    constexpr static const float        top_density = 0.25f; ///< top level cells per element
+    constexpr static const float        cell_density = 2; ///< refinement cells per element
+    static const int                    refine_min_elems = 16; ///< min elements in a cell for refinement
+    static const int                    max_res = 256; ///< max resolution per axis
+    
+    GridCells                           top; ///< top level grid
+    vector<GridCells>                   cells; ///< refinement grids
+    
+    /// Constructor (sets element number and functions)
+    GridAccelerator(int intersect_elem_num,
+                    const function<range3f (int)> intersect_elem_bounds,
+                    const function<bool (int,const ray3f&,intersection3f&)> intersect_elem_first,
+                    const function<bool (int,const ray3f&)> intersect_elem_any) :
+                    Accelerator(intersect_elem_num, intersect_elem_bounds, intersect_elem_first, intersect_elem_any) { _tid = _typeuid; }
+};
+
 ///@name intersect interface
 ///@{
+Accelerator* intersect_accelerator_new(const string& type, int intersect_elem_num,
+                                       const function<range3f (int)> intersect_elem_bounds,
+                                       const function<bool (int,const ray3f&,intersection3f&)> intersect_elem_first,
+                                       const function<bool (int,const ray3f&)> intersect_elem_any);
+range3f intersect_accelerator_bounds(Accelerator* accelerator);
+void intersect_accelerator_build(Accelerator* accelerator);
+bool intersect_accelerator_first(Accelerator* accelerator, const ray3f& ray, intersection3f& intersection);
+bool intersect_accelerator_any(Accelerator* accelerator, const ray3f& ray);
+bool intersect_accelerator_any(Accelerator* accelerator, const ray3f& ray, int& elementid);
+void intersect_accelerator_update(Accelerator* accelerator, int elementid);
+
 range3f intersect_bvh_bounds(BVHAccelerator* bvh);
 void intersect_bvh_accelerate(BVHAccelerator* bvh);
 bool intersect_bvh_first(BVHAccelerator* bvh, const ray3f& ray, intersection3f& intersection);
 bool intersect_bvh_any(BVHAccelerator* bvh, const ray3f& ray);
+bool intersect_bvh_any(BVHAccelerator* bvh, const ray3f& ray, int& elementid);
+void intersect_bvh_update(BVHAccelerator* bvh, int elementid);
+
+range3f intersect_grid_bounds(GridAccelerator* grid);
+void intersect_grid_accelerate(GridAccelerator* grid);
+bool intersect_grid_first(GridAccelerator* grid, const ray3f& ray, intersection3f& intersection);
+bool intersect_grid_any(GridAccelerator* grid, const ray3f& ray, int& elementid);
+void intersect_grid_update(GridAccelerator* grid, int elementid);
 ///@}
 
 ///@}
@@ -59,8 +59,30 @@ inline mat4f camera_viewmatrix(Camera* camera) {
 }
 ///@}
 
+/// Ray cone footprint, used for texture filtering
+struct RayCone {
+    float width = 0; ///< cone width at the ray origin
+    float spread = 0; ///< width growth per unit distance along the ray
+};
+
 ///@name sample interface
 ///@{
+
+/// footprint of a camera ray through a pixel, for an image with h pixel rows
+inline RayCone camera_ray_cone(Camera* camera, int h) {
+    auto ret = RayCone();
+    if(not camera->orthographic) ret.spread = camera->image_height / (camera->image_dist * h);
+    else ret.width = camera->image_height / h;
+    return ret;
+}
+
+/// cone after travelling a distance t along the ray
+inline RayCone ray_cone_advance(const RayCone& cone, float t) {
+    auto ret = cone;
+    ret.width += cone.spread * t;
+    return ret;
+}
+
 inline ray3f camera_ray(Camera* camera, const vec2f& uv) {
     ray3f rayl;
     if(not camera->orthographic) {
@@ -5,10 +5,121 @@
 
 ///@file igl/distraytrace.cpp Distribution Raytracing. @ingroup igl
 
-vec3f _distraytrace_scene_ray(Scene* scene, const ray3f& ray, DistributionRaytraceOptions& opts, int depth) {
+// unoccluded direct lighting from the light center, a cheap estimate of the light contribution
+float _distraytrace_light_estimate(Light* l, const frame3f& frame, const vec3f& wo, const Brdf& brdf) {
+    auto ss = light_shadow_sample(l, frame.o, zero2f, false);
+    if(ss.radiance == zero3f) return 0;
+    return mean_component(ss.radiance * material_brdfcos(brdf,frame,ss.dir,wo) / ss.pdf);
+}
+
+// direct lighting from a light, averaging shadow_samples samples for area and env lights;
+// max_estimate is the largest light estimate at the point, used by adaptive shadows
+vec3f _distraytrace_light(Scene* scene, Light* l, int shadow_samples, float max_estimate, const frame3f& frame, const vec3f& wo, const Brdf& brdf, DistributionRaytraceOptions& opts) {
+    ShadowSample ss;
+    vec3f cl;
+    vec3f c = zero3f;
+    vec3f acc = zero3f;
+    auto light_brdf = brdf;
+    // Prefiltered environment irradiance: diffuse from the irradiance spherical harmonics,
+    // scaled by the unoccluded fraction of a few cosine distributed rays
+    if(is<EnvLight>(l) and cast<EnvLight>(l)->irradiance_sh) {
+        auto env = cast<EnvLight>(l);
+        float unoccluded = 1;
+        if(opts.shadows and env->occlusion_samples > 0) {
+            int escaped = 0;
+            for(int i = 0; i < env->occlusion_samples; i++) {
+                auto ds = sample_direction_hemisphericalcos(opts.rng.next_vec2f());
+                if(not intersect_scene_occluded(scene, ray3f(frame.o, transform_direction(frame, ds.dir)), l)) escaped++;
+            }
+            unoccluded = (float) escaped / (float) env->occlusion_samples;
+        }
+        c += material_diffuse_albedo(brdf) / pif * envlight_irradiance(env, frame.z) * unoccluded;
+        // glossy lobes are still shadow sampled
+        if(brdf.type != Brdf::phong or brdf.specular == zero3f) return c;
+        light_brdf.diffuse = zero3f;
+    }
+    // Distribution raytracing - soft shadows (5.0 points)
+    // Perform distribution raytracing with soft shadows, as described in the lecture notes
+    if(is<AreaLight>(l) or is<EnvLight>(l)) {
+        int lit = 0, occluded = 0;
+        auto trace_sample = [&](bool shadows) {
+            auto sample = vec2f(opts.rng.next_float(), opts.rng.next_float());
+            ss = light_shadow_sample(l, frame.o, sample, true);
+            auto wi = ss.dir;
+            if(ss.radiance == zero3f) return;
+            cl = ss.radiance * material_brdfcos(light_brdf,frame,wi,wo) / ss.pdf;
+            if(cl == zero3f) return;
+            if(shadows) {
+                if(not intersect_scene_occluded(scene,ray3f::segment(frame.o,frame.o+ss.dir*ss.dist),l)) { acc += cl; lit++; }
+                else occluded++;
+            } else acc += cl;
+        };
+        // Adaptive shadows: a few shadow rays first; if they all agree the light is taken as fully occluded,
+        // or as fully visible and sampled without further shadow rays; in penumbrae the shadow rays budget
+        // scales with the light solid angle and with its contribution relative to the brightest light
+        auto nsamples = shadow_samples;
+        if(opts.adaptive_shadows and opts.shadows and is<AreaLight>(l) and opts.adaptive_shadows_min > 0 and shadow_samples > opts.adaptive_shadows_min) {
+            for(int i = 0; i < opts.adaptive_shadows_min; i++) trace_sample(true);
+            if(not lit) nsamples = opts.adaptive_shadows_min;
+            else if(not occluded) { for(int i = opts.adaptive_shadows_min; i < shadow_samples; i++) trace_sample(false); }
+            else {
+                auto scale = min(1.0f, arealight_solidangle(cast<AreaLight>(l), frame.o) / opts.adaptive_shadows_solidangle);
+                if(max_estimate > 0) scale *= min(1.0f, _distraytrace_light_estimate(l, frame, wo, light_brdf) / max_estimate);
+                nsamples = clamp((int)ceil(shadow_samples * scale), opts.adaptive_shadows_min, shadow_samples);
+                for(int i = opts.adaptive_shadows_min; i < nsamples; i++) trace_sample(true);
+            }
+        }
+        else for(int i = 0; i < shadow_samples; i++) trace_sample(opts.shadows);
+        c += acc / nsamples;
+    }
+    else {
+        ss = light_shadow_sample(l, frame.o, zero2f, false);
+        auto wi = ss.dir;
+        if(ss.radiance == zero3f) return c;
+        cl = ss.radiance * material_brdfcos(brdf,frame,wi,wo) / ss.pdf;
+        if(cl == zero3f) return c;
+        if(opts.shadows) {
+            if(not intersect_scene_occluded(scene,ray3f::segment(frame.o,frame.o+ss.dir*ss.dist),l)) c += cl;
+        } else c += cl;
+    }
+    return c;
+}
+
+// Final gather: indirect lighting from the global photon map estimates at the hits of a few brdf sampled rays,
+// followed through mirror reflections
+vec3f _distraytrace_photon_gather(Scene* scene, PhotonMaps* photons, const frame3f& frame, const vec3f& wo, const Brdf& brdf, DistributionRaytraceOptions& opts) {
+    auto c = zero3f;
+    for(int i = 0; i < opts.photons_gather; i++) {
+        auto bs = material_sample_brdfcos(brdf, frame, wo, opts.rng.next_float(), opts.rng.next_vec2f());
+        if(bs.brdfcos == zero3f or bs.pdf <= 0) continue;
+        auto weight = bs.brdfcos / bs.pdf;
+        auto ray = ray3f(frame.o, bs.wi);
+        for(int depth = 0; depth < opts.max_depth; depth++) {
+            intersection3f intersection;
+            if(not intersect_scene_first(scene,ray,intersection)) break;
+            auto gframe = intersection.frame;
+            if(opts.doublesided) gframe = faceforward(gframe,ray.d);
+            gframe = material_shading_frame(intersection.material, gframe, intersection.texcoord);
+            auto gbrdf = material_shading_textures(scene->_materials, intersection.material, intersection.texcoord, 0);
+            c += weight * photonmap_radiance(photons->global, photons->emitted, gframe, gbrdf, -ray.d, opts.photons_lookup, opts.photons_radius);
+            auto refl = (opts.reflections) ? material_sample_reflection(gbrdf, gframe, -ray.d) : BrdfSample();
+            if(refl.brdfcos == zero3f) break;
+            weight *= refl.brdfcos;
+            ray = ray3f(gframe.o, refl.wi);
+        }
+    }
+    return c / opts.photons_gather;
+}
+
+vec3f _distraytrace_scene_ray(Scene* scene, const ray3f& ray, const RayCone& cone, DistributionRaytraceOptions& opts, int depth) {
     // intersect
     intersection3f intersection;
-    if(not intersect_scene_first(scene,ray,intersection)) return opts.background;
+    if(not intersect_scene_first(scene,ray,intersection)) {
+        auto& ll = (opts.cameralights) ? scene->_cameralights : scene->lights;
+        auto c = opts.background;
+        for(auto l : ll->lights) c += light_sample_background(l, ray.d);
+        return c;
+    }
 
     // set up variables
     auto frame = intersection.frame;
@@ -21,14 +132,19 @@ vec3f _distraytrace_scene_ray(Scene* scene, const ray3f& ray, DistributionRaytra
     frame = material_shading_frame(material, frame, texcoord);
 
     // brdf
-    auto brdf = material_shading_textures(intersection.material, intersection.texcoord, length(frame.o - scene->camera->frame.o));
+    auto hit_cone = ray_cone_advance(cone, intersection.ray_t);
+    auto texcoord_width = hit_cone.width * intersection.texcoord_density / max(abs(dot(wo, intersection.frame.z)), 0.01f);
+    auto brdf = material_shading_textures(scene->_materials, intersection.material, intersection.texcoord, texcoord_width);
 
     // compute ambient
     vec3f c = zero3f;
 
+    // photon mapping: indirect lighting from the global map replaces the ambient term
+    auto photons = (opts.photons > 0) ? opts._photons.get() : nullptr;
+    if(photons and opts.photons_gather > 0) c += _distraytrace_photon_gather(scene, photons, frame, wo, brdf, opts);
     // Ambient occlusion (5.0 points)
     // Perform ambient occlusion calculation
-    if(opts.samples_ambient > 0) {
+    else if(opts.samples_ambient > 0) {
         int total_escaped_ss_rays = 0;
         for(int i = 0; i < opts.samples_ambient; i++) {
             float x = opts.rng.next_float();
@@ -36,7 +152,7 @@ vec3f _distraytrace_scene_ray(Scene* scene, const ray3f& ray, DistributionRaytra
             auto ds = sample_direction_hemisphericalcos(vec2f(x,y));
             auto wi = transform_direction(frame, ds.dir);
             ray3f ray = ray3f(frame.o, wi);
-            if(not intersect_scene_any(scene, ray)) total_escaped_ss_rays++;
+            if(not intersect_scene_occluded(scene, ray, nullptr)) total_escaped_ss_rays++;
         }
         float escaped_ratio = (float) total_escaped_ss_rays/ (float) opts.samples_ambient;
         c += opts.ambient * escaped_ratio * material_diffuse_albedo(brdf);
@@ -49,51 +165,37 @@ vec3f _distraytrace_scene_ray(Scene* scene, const ray3f& ray, DistributionRaytra
 
     // compute direct
     auto& ll = (opts.cameralights) ? scene->_cameralights : scene->lights;
+    auto select = opts.light_selection != "all" and not ll->_local.empty();
+    auto max_estimate = 0.0f;
+    if(opts.adaptive_shadows) {
+        for(auto l : ll->lights) if(not (select and light_is_local(l))) max_estimate = max(max_estimate, _distraytrace_light_estimate(l, frame, wo, brdf));
+    }
     for(auto l : ll->lights) {
-        ShadowSample ss;
-        vec3f cl;
-        vec3f acc = zero3f;
-        // Distribution raytracing - soft shadows (5.0 points)
-        // Perform distribution raytracing with soft shadows, as described in the lecture notes
-        if(is<AreaLight>(l)) {
-            auto area_light = cast<AreaLight>(l);
-            for(int i = 0; i < area_light->shadow_samples; i++) {
-                auto sample = vec2f(opts.rng.next_float(), opts.rng.next_float());
-                ss = light_shadow_sample(l, frame.o, sample, true);
-                auto wi = ss.dir;
-                if(ss.radiance == zero3f) continue;
-                cl = ss.radiance * material_brdfcos(brdf,frame,wi,wo) / ss.pdf;
-                if(cl == zero3f) continue;
-                if(opts.shadows) {
-                    if(not intersect_scene_any(scene,ray3f::segment(frame.o,frame.o+ss.dir*ss.dist))) acc += cl;
-                } else acc += cl;
-            }
-            c += acc / area_light->shadow_samples;
-        }
-        else {
-            ss = light_shadow_sample(l, frame.o, zero2f, false);
-            auto wi = ss.dir;
-            if(ss.radiance == zero3f) continue;
-            cl = ss.radiance * material_brdfcos(brdf,frame,wi,wo) / ss.pdf;
-            if(cl == zero3f) continue;
-            if(opts.shadows) {
-                if(not intersect_scene_any(scene,ray3f::segment(frame.o,frame.o+ss.dir*ss.dist))) c += cl;
-            } else c += cl;
+        if(select and light_is_local(l)) continue;
+        c += _distraytrace_light(scene, l, light_shadow_nsamples(l), max_estimate, frame, wo, brdf, opts);
+    }
+    // Light selection: a few local lights picked by power or by the light bvh, with one shadow ray each,
+    // so that the cost does not grow with the number of lights
+    if(select) {
+        for(int i = 0; i < opts.light_samples; i++) {
+            auto ls = light_select(ll, opts.light_selection, frame.o, frame.z, opts.rng.next_float());
+            if(ls.idx < 0) continue;
+            c += _distraytrace_light(scene, ll->lights[ls.idx], 1, 0, frame, wo, brdf, opts) / (ls.pdf * opts.light_samples);
         }
     }
 
+    // caustics, which lights sampling cannot reach through mirrors
+    if(photons) c += photonmap_radiance(photons->caustic, photons->emitted, frame, brdf, wo, opts.photons_lookup, opts.photons_radius);
+
     // recursively compute reflections
     if(opts.reflections and depth < opts.max_depth) {
         auto bs = material_sample_reflection(brdf, frame, wo);
         if(not (bs.brdfcos == zero3f)) {
             auto refl_ray = ray3f(frame.o,bs.wi);
-            c += _distraytrace_scene_ray(scene, refl_ray, opts, depth+1) * bs.brdfcos;
+            c += _distraytrace_scene_ray(scene, refl_ray, hit_cone, opts, depth+1) * bs.brdfcos;
         }
     }
 
-    // cleanup
-    delete brdf;
-
     // done
     return c;
 }
@@ -101,6 +203,13 @@ vec3f _distraytrace_scene_ray(Scene* scene, const ray3f& ray, DistributionRaytra
 void distraytrace_scene_progressive(ImageBuffer& buffer, Scene* scene, DistributionRaytraceOptions& opts) {
     auto w = buffer.width();
     auto h = buffer.height();
+    auto cone = camera_ray_cone(scene->camera, h);
+
+    // photon maps are traced before the first pass, and again only if their inputs change
+    auto photon_lights = (opts.cameralights) ? scene->_cameralights : scene->lights;
+    if(opts.photons > 0 and not photonmap_traced_with(opts._photons.get(), photon_lights, opts.photons, opts.photons_gather > 0, opts.doublesided, opts.reflections)) {
+        opts._photons = photonmap_trace(scene, photon_lights, opts.photons, opts.photons_gather > 0, opts.doublesided, opts.reflections, opts.rng);
+    }
 
     int s2 = max(1,(int)sqrt(opts.samples));
     for(int j = 0; j < h; j ++) {
@@ -131,7 +240,7 @@ void distraytrace_scene_progressive(ImageBuffer& buffer, Scene* scene, Distribut
                     auto Qi = scene->camera->frame.o + ((i - w/2) * scale + 0.5f - ri.x) * lp.x * f.x + ((j - h/2) * scale + 0.5f - ri.y) * lp.y * f.y - n * f.z;
 
                     ray3f ray = ray3f(Fi, normalize(Qi - Fi));
-                    buffer.accum.at(i,h-1-j) += _distraytrace_scene_ray(scene,ray,opts,0);
+                    buffer.accum.at(i,h-1-j) += _distraytrace_scene_ray(scene,ray,cone,opts,0);
                     buffer.samples.at(i,h-1-j) += 1;
                 }
             }
@@ -141,7 +250,7 @@ void distraytrace_scene_progressive(ImageBuffer& buffer, Scene* scene, Distribut
                 float u = (i+(ii+0.5)/s2)/w;
                 float v = (j+(jj+0.5)/s2)/h;
                 ray3f ray = camera_ray(scene->camera,vec2f(u,v));
-                buffer.accum.at(i,h-1-j) += _distraytrace_scene_ray(scene,ray,opts,0);
+                buffer.accum.at(i,h-1-j) += _distraytrace_scene_ray(scene,ray,cone,opts,0);
                 buffer.samples.at(i,h-1-j) += 1;
             }
         }
@@ -2,6 +2,7 @@
 #define _DISTRAYTRACE_H_
 
 #include "scene.h"
+#include "photonmap.h"
 
 ///@file igl/distraytrace.h Distribution Raytracing. @ingroup igl
 ///@defgroup distraytrace Distribution Raytracing
@@ -35,7 +36,20 @@ struct DistributionRaytraceOptions : Node {
     
     int max_depth = 4; ///< maximum ray recursion for reflections
     
+    string light_selection = "all"; ///< shade all lights, or light_samples local lights picked by "power" or by the light "bvh"
+    int light_samples = 1; ///< local lights picked per shading point with light selection
+    
+    bool adaptive_shadows = false; ///< scale area light shadow rays by solid angle and contribution, stopping early when they agree
+    int adaptive_shadows_min = 4; ///< shadow rays traced before testing for agreement
+    float adaptive_shadows_solidangle = 0.1f; ///< solid angle (sr) from which the dominant light gets all its shadow rays
+    
+    int photons = 0; ///< photons emitted from the local lights for caustics and indirect lighting (0: off)
+    int photons_lookup = 64; ///< nearest photons in each radiance estimate
+    float photons_radius = 0.1f; ///< maximum distance of the photons in each radiance estimate
+    int photons_gather = 16; ///< final gather rays estimating indirect lighting from the global photon map, in place of the ambient term (0: caustics only)
+    
     Rng rng; ///< random number generator
+    shared_ptr<PhotonMaps> _photons; ///< photon maps, traced before the first pass and shared by copies of the options
 };
 
 
@@ -2,8 +2,18 @@
 
 #include "scene.h"
 
+#include <mutex>
+#include <unordered_set>
+
 ///@file igl/intersect.cpp Intersection. @ingroup igl
 
+// texcoord density of a triangle, as the square root of its texcoord area over its surface area (0 for degenerate triangles)
+float _triangle_texcoord_density(const vec3f& v0, const vec3f& v1, const vec3f& v2, const vec2f& t0, const vec2f& t1, const vec2f& t2) {
+    auto area = length(cross(v1-v0,v2-v0));
+    auto texcoord_area = abs((t1.x-t0.x)*(t2.y-t0.y)-(t1.y-t0.y)*(t2.x-t0.x));
+    return (area > 0) ? sqrt(texcoord_area / area) : 0;
+}
+
 bool intersect_pointset_element_first(PointSet* pointset, int elementid, const ray3f& ray, intersection3f& intersection) {
     if(pointset->approximate) {
         float t;
@@ -37,6 +47,14 @@ bool intersect_pointset_element_first(PointSet* pointset, int elementid, const r
     }
 }
 
+// texcoord density along a line, the texcoords running from one end to the other
+float _lineset_texcoord_density(LineSet* lines, int elementid) {
+    auto l = lines->line[elementid];
+    auto h = length(lines->pos[l.y]-lines->pos[l.x]);
+    if(h == 0) return 0;
+    return ((lines->texcoord.empty()) ? 1 : length(lines->texcoord[l.y]-lines->texcoord[l.x])) / h;
+}
+
 bool intersect_lineset_element_first(LineSet* lines, int elementid, const ray3f& ray, intersection3f& intersection) {
     if(lines->approximate) {
         auto l = lines->line[elementid];
@@ -55,6 +73,7 @@ bool intersect_lineset_element_first(LineSet* lines, int elementid, const ray3f&
         // TODO: check frame after -> left handed?
         intersection.geom_norm = intersection.frame.z;
         intersection.texcoord = (lines->texcoord.empty()) ? vec2f(intersection.uv.x,0) : (lines->texcoord[l.x]*(1-intersection.uv.x)+lines->texcoord[l.y]*intersection.uv.x);
+        intersection.texcoord_density = _lineset_texcoord_density(lines, elementid);
         
         return true;
     } else {
@@ -75,6 +94,7 @@ bool intersect_lineset_element_first(LineSet* lines, int elementid, const ray3f&
         intersection.frame = lineset_frame(lines, elementid, intersection.uv);
         intersection.geom_norm = intersection.frame.z;
         intersection.texcoord = (lines->texcoord.empty()) ? vec2f(intersection.uv.y,0) : (lines->texcoord[l.x]*(1-intersection.uv.y)+lines->texcoord[l.y]*intersection.uv.y);
+        intersection.texcoord_density = _lineset_texcoord_density(lines, elementid);
         
         return true;        
     }
@@ -91,38 +111,65 @@ bool intersect_trianglemesh_element_first(TriangleMesh* mesh, int elementid, con
     
     intersection.frame = trianglemesh_frame(mesh, elementid, intersection.uv);
     intersection.geom_norm = triangle_normal(mesh->pos[f.x], mesh->pos[f.y], mesh->pos[f.z]);
+    if(not mesh->texcoord.empty()) {
+        intersection.texcoord = interpolate_baricentric_triangle(mesh->texcoord, f, uv);
+        intersection.texcoord_density = _triangle_texcoord_density(mesh->pos[f.x], mesh->pos[f.y], mesh->pos[f.z], mesh->texcoord[f.x], mesh->texcoord[f.y], mesh->texcoord[f.z]);
+    }
     
     return true;
 }
 
 bool intersect_mesh_element_first(Mesh* mesh, int elementid, const ray3f& ray, intersection3f& intersection) {
-    auto f = mesh_triangle_face(mesh,elementid);
-
+    int triangleid = elementid;
     float t; vec2f uv;
-    bool hit = intersect_triangle(ray, mesh->pos[f.x], mesh->pos[f.y], mesh->pos[f.z], t, uv.x, uv.y);
-    if(not hit) return false;
+    if(elementid < mesh->triangle.size()) {
+        auto f = mesh->triangle[elementid];
+        if(not intersect_triangle(ray, mesh->pos[f.x], mesh->pos[f.y], mesh->pos[f.z], t, uv.x, uv.y)) return false;
+    } else {
+        auto f = mesh->quad[elementid - mesh->triangle.size()];
+        int half;
+        if(not intersect_quad(ray, mesh->pos[f.x], mesh->pos[f.y], mesh->pos[f.z], mesh->pos[f.w], t, uv.x, uv.y, half)) return false;
+        triangleid = mesh->triangle.size() + (elementid - mesh->triangle.size())*2 + half;
+    }
+    auto f = mesh_triangle_face(mesh,triangleid);
     
     intersection.ray_t = t;
     intersection.uv = uv;
     
-    intersection.frame = mesh_frame(mesh, elementid, intersection.uv);
+    intersection.frame = mesh_frame(mesh, triangleid, intersection.uv);
     intersection.geom_norm = triangle_normal(mesh->pos[f.x],mesh->pos[f.y],mesh->pos[f.z]);
+    if(not mesh->texcoord.empty()) {
+        intersection.texcoord = interpolate_baricentric_triangle(mesh->texcoord, f, uv);
+        intersection.texcoord_density = _triangle_texcoord_density(mesh->pos[f.x], mesh->pos[f.y], mesh->pos[f.z], mesh->texcoord[f.x], mesh->texcoord[f.y], mesh->texcoord[f.z]);
+    }
     
     return true;        
 }
 
 bool intersect_facemesh_element_first(FaceMesh* mesh, int elementid, const ray3f& ray, intersection3f& intersection) {
-    auto f = facemesh_triangle_face(mesh,elementid);
-    
+    int triangleid = elementid;
     float t; vec2f uv;
-    bool hit = intersect_triangle(ray, mesh->pos[mesh->vertex[f.x].x], mesh->pos[mesh->vertex[f.y].x], mesh->pos[mesh->vertex[f.z].x], t, uv.x, uv.y);
-    if(not hit) return false;
+    if(elementid < mesh->triangle.size()) {
+        auto f = mesh->triangle[elementid];
+        if(not intersect_triangle(ray, mesh->pos[mesh->vertex[f.x].x], mesh->pos[mesh->vertex[f.y].x], mesh->pos[mesh->vertex[f.z].x], t, uv.x, uv.y)) return false;
+    } else {
+        auto f = mesh->quad[elementid - mesh->triangle.size()];
+        int half;
+        if(not intersect_quad(ray, mesh->pos[mesh->vertex[f.x].x], mesh->pos[mesh->vertex[f.y].x], mesh->pos[mesh->vertex[f.z].x], mesh->pos[mesh->vertex[f.w].x], t, uv.x, uv.y, half)) return false;
+        triangleid = mesh->triangle.size() + (elementid - mesh->triangle.size())*2 + half;
+    }
+    auto f = facemesh_triangle_face(mesh,triangleid);
     
     intersection.ray_t = t;
     intersection.uv = uv;
     
-    intersection.frame = facemesh_frame(mesh, elementid, intersection.uv);
+    intersection.frame = facemesh_frame(mesh, triangleid, intersection.uv);
     intersection.geom_norm = triangle_normal(mesh->pos[mesh->vertex[f.x].x],mesh->pos[mesh->vertex[f.y].x],mesh->pos[mesh->vertex[f.z].x]);
+    if(not mesh->texcoord.empty()) {
+        auto t0 = mesh->texcoord[mesh->vertex[f.x].z], t1 = mesh->texcoord[mesh->vertex[f.y].z], t2 = mesh->texcoord[mesh->vertex[f.z].z];
+        intersection.texcoord = interpolate_baricentric_triangle(t0, t1, t2, uv);
+        intersection.texcoord_density = _triangle_texcoord_density(mesh->pos[mesh->vertex[f.x].x], mesh->pos[mesh->vertex[f.y].x], mesh->pos[mesh->vertex[f.z].x], t0, t1, t2);
+    }
     
     return true;
 }
@@ -147,13 +194,23 @@ bool intersect_trianglemesh_element_any(TriangleMesh* mesh, int elementid, const
 }
 
 bool intersect_mesh_element_any(Mesh* mesh, int elementid, const ray3f& ray) {
-    auto f = mesh_triangle_face(mesh,elementid);
-    return intersect_triangle(ray, mesh->pos[f.x], mesh->pos[f.y], mesh->pos[f.z]);
+    if(elementid < mesh->triangle.size()) {
+        auto f = mesh->triangle[elementid];
+        return intersect_triangle(ray, mesh->pos[f.x], mesh->pos[f.y], mesh->pos[f.z]);
+    } else {
+        auto f = mesh->quad[elementid - mesh->triangle.size()];
+        return intersect_quad(ray, mesh->pos[f.x], mesh->pos[f.y], mesh->pos[f.z], mesh->pos[f.w]);
+    }
 }
 
 bool intersect_facemesh_element_any(FaceMesh* mesh, int elementid, const ray3f& ray) {
-    auto f = facemesh_triangle_face(mesh,elementid);
-    return intersect_triangle(ray, mesh->pos[mesh->vertex[f.x].x], mesh->pos[mesh->vertex[f.y].x], mesh->pos[mesh->vertex[f.z].x]);
+    if(elementid < mesh->triangle.size()) {
+        auto f = mesh->triangle[elementid];
+        return intersect_triangle(ray, mesh->pos[mesh->vertex[f.x].x], mesh->pos[mesh->vertex[f.y].x], mesh->pos[mesh->vertex[f.z].x]);
+    } else {
+        auto f = mesh->quad[elementid - mesh->triangle.size()];
+        return intersect_quad(ray, mesh->pos[mesh->vertex[f.x].x], mesh->pos[mesh->vertex[f.y].x], mesh->pos[mesh->vertex[f.z].x], mesh->pos[mesh->vertex[f.w].x]);
+    }
 }
 
 range3f intersect_pointset_element_bounds(PointSet* pointset, int elementid) {
@@ -162,11 +219,9 @@ range3f intersect_pointset_element_bounds(PointSet* pointset, int elementid) {
 
 range3f intersect_lineset_element_bounds(LineSet* lines, int elementid) {
     auto l = lines->line[elementid];
-    auto f = lineset_cylinder_frame(lines, elementid);
+    if(lines->approximate) return runion(sphere_bounds(lines->pos[l.x],lines->radius[l.x]),sphere_bounds(lines->pos[l.y],lines->radius[l.y]));
     auto r = (lines->radius[l.y]+lines->radius[l.x])/2;
-    auto h = length(lines->pos[l.y]-lines->pos[l.x]);
-    
-    return transform_bbox(f,cylinder_bounds(r,h));
+    return cylinder_bounds(lines->pos[l.x],lines->pos[l.y],r);
 }
 
 range3f intersect_trianglemesh_element_bounds(TriangleMesh* mesh, int elementid) {
@@ -175,17 +230,118 @@ range3f intersect_trianglemesh_element_bounds(TriangleMesh* mesh, int elementid)
 }
 
 range3f intersect_mesh_element_bounds(Mesh* mesh, int elementid) {
-    auto f = mesh_triangle_face(mesh,elementid);
-    return triangle_bounds(mesh->pos[f.x], mesh->pos[f.y], mesh->pos[f.z]);
+    if(elementid < mesh->triangle.size()) {
+        auto f = mesh->triangle[elementid];
+        return triangle_bounds(mesh->pos[f.x], mesh->pos[f.y], mesh->pos[f.z]);
+    } else {
+        auto f = mesh->quad[elementid - mesh->triangle.size()];
+        return quad_bounds(mesh->pos[f.x], mesh->pos[f.y], mesh->pos[f.z], mesh->pos[f.w]);
+    }
 }
 
 range3f intersect_facemesh_element_bounds(FaceMesh* mesh, int elementid) {
-    auto f = facemesh_triangle_face(mesh,elementid);
-    return triangle_bounds(mesh->pos[mesh->vertex[f.x].x], mesh->pos[mesh->vertex[f.y].x], mesh->pos[mesh->vertex[f.z].x]);
+    if(elementid < mesh->triangle.size()) {
+        auto f = mesh->triangle[elementid];
+        return triangle_bounds(mesh->pos[mesh->vertex[f.x].x], mesh->pos[mesh->vertex[f.y].x], mesh->pos[mesh->vertex[f.z].x]);
+    } else {
+        auto f = mesh->quad[elementid - mesh->triangle.size()];
+        return quad_bounds(mesh->pos[mesh->vertex[f.x].x], mesh->pos[mesh->vertex[f.y].x], mesh->pos[mesh->vertex[f.z].x], mesh->pos[mesh->vertex[f.w].x]);
+    }
 }
 
+///@name packed leaf kernels
+///@{
+const int _intersect_packed_lanes = 4; ///< elements culled together
+const float _intersect_packed_slack = 1.001f; ///< radius scaling to keep culling conservative
+const float _intersect_packed_tolerance = 1e-6f; ///< squared distance tolerance, relative to the squared distance from the ray origin
+
+/// Packed spheres in bvh order (structure of arrays, padded to full lanes)
+struct _PackedSpheres { vector<float> x, y, z, r; };
+
+/// Packed capsules in bvh order (structure of arrays, padded to full lanes)
+struct _PackedCapsules { vector<float> x0, y0, z0, x1, y1, z1, r; };
+
+// bounding spheres that overlap the ray segment (distance computed from the projected center for precision)
+void _intersect_packed_spheres_cull(const _PackedSpheres& p, int start, const ray3f& ray, bool* mask) {
+    auto a = dot(ray.d,ray.d), ia = 1 / a;
+    for(int k = 0; k < _intersect_packed_lanes; k ++) {
+        auto ox = p.x[start+k] - ray.e.x, oy = p.y[start+k] - ray.e.y, oz = p.z[start+k] - ray.e.z;
+        auto tc = (ray.d.x*ox + ray.d.y*oy + ray.d.z*oz) * ia;
+        auto qx = ox - tc*ray.d.x, qy = oy - tc*ray.d.y, qz = oz - tc*ray.d.z;
+        auto r2 = p.r[start+k]*p.r[start+k] + _intersect_packed_tolerance*(ox*ox + oy*oy + oz*oz);
+        auto h2 = r2 - (qx*qx + qy*qy + qz*qz);
+        // chord [tc-h,tc+h] overlaps [tmin,tmax], compared squared to avoid the sqrt
+        auto dmin = max(ray.tmin - tc, 0.0f), dmax = max(tc - ray.tmax, 0.0f);
+        mask[k] = (h2 >= 0) & (dmin*dmin*a <= h2) & (dmax*dmax*a <= h2);
+    }
+}
+
+// bounding capsules within reach of the ray segment (closest points between segments, from Ericson's RTCD)
+void _intersect_packed_capsules_cull(const _PackedCapsules& p, int start, const ray3f& ray, bool* mask) {
+    auto a = dot(ray.d,ray.d);
+    for(int k = 0; k < _intersect_packed_lanes; k ++) {
+        auto vx = p.x1[start+k] - p.x0[start+k], vy = p.y1[start+k] - p.y0[start+k], vz = p.z1[start+k] - p.z0[start+k];
+        auto wx = ray.e.x - p.x0[start+k], wy = ray.e.y - p.y0[start+k], wz = ray.e.z - p.z0[start+k];
+        auto b = ray.d.x*vx + ray.d.y*vy + ray.d.z*vz;
+        auto c = ray.d.x*wx + ray.d.y*wy + ray.d.z*wz;
+        auto e = vx*vx + vy*vy + vz*vz;
+        auto f = vx*wx + vy*wy + vz*wz;
+        auto denom = a*e - b*b;
+        // a zero-length segment is a sphere around its end point, closest to the ray at the projected center
+        auto t = (e > 0) ? ((denom > 0) ? clamp((b*f - c*e)/denom, ray.tmin, ray.tmax) : ray.tmin) : clamp(-c/a, ray.tmin, ray.tmax);
+        auto s = (e > 0) ? (b*t + f)/e : 0.0f;
+        t = (s < 0) ? clamp(-c/a, ray.tmin, ray.tmax) : ((s > 1) ? clamp((b-c)/a, ray.tmin, ray.tmax) : t);
+        s = clamp(s, 0.0f, 1.0f);
+        auto dx = wx + t*ray.d.x - s*vx, dy = wy + t*ray.d.y - s*vy, dz = wz + t*ray.d.z - s*vz;
+        mask[k] = dx*dx + dy*dy + dz*dz <= p.r[start+k]*p.r[start+k] + _intersect_packed_tolerance*(wx*wx + wy*wy + wz*wz);
+    }
+}
+
+// runs a packed culling kernel over the lanes covering [start,end) and collects candidates
+template<typename Packed, void (*cull)(const Packed&, int, const ray3f&, bool*)>
+int _intersect_packed_leaf_cull(const Packed& packed, int start, int end, const ray3f& ray, int* candidates) {
+    int ncandidates = 0;
+    bool mask[_intersect_packed_lanes];
+    for(int block = start; block < end; block += _intersect_packed_lanes) {
+        cull(packed, block, ray, mask);
+        for(int k = 0; k < _intersect_packed_lanes and block+k < end; k ++) {
+            if(mask[k]) candidates[ncandidates++] = block+k;
+        }
+    }
+    return ncandidates;
+}
+
+shared_ptr<_PackedSpheres> _intersect_pack_pointset(PointSet* pointset, BVHAccelerator* bvh) {
+    auto packed = make_shared<_PackedSpheres>();
+    auto n = bvh->sorted_prims.size() + _intersect_packed_lanes;
+    packed->x.assign(n, 0); packed->y.assign(n, 0); packed->z.assign(n, 0); packed->r.assign(n, 0);
+    for(auto idx : range(bvh->sorted_prims.size())) {
+        auto i = bvh->sorted_prims[idx];
+        packed->x[idx] = pointset->pos[i].x;
+        packed->y[idx] = pointset->pos[i].y;
+        packed->z[idx] = pointset->pos[i].z;
+        packed->r[idx] = pointset->radius[i] * _intersect_packed_slack;
+    }
+    return packed;
+}
+
+shared_ptr<_PackedCapsules> _intersect_pack_lineset(LineSet* lines, BVHAccelerator* bvh) {
+    auto packed = make_shared<_PackedCapsules>();
+    auto n = bvh->sorted_prims.size() + _intersect_packed_lanes;
+    packed->x0.assign(n, 0); packed->y0.assign(n, 0); packed->z0.assign(n, 0);
+    packed->x1.assign(n, 0); packed->y1.assign(n, 0); packed->z1.assign(n, 0); packed->r.assign(n, 0);
+    for(auto idx : range(bvh->sorted_prims.size())) {
+        auto l = lines->line[bvh->sorted_prims[idx]];
+        packed->x0[idx] = lines->pos[l.x].x; packed->y0[idx] = lines->pos[l.x].y; packed->z0[idx] = lines->pos[l.x].z;
+        packed->x1[idx] = lines->pos[l.y].x; packed->y1[idx] = lines->pos[l.y].y; packed->z1[idx] = lines->pos[l.y].z;
+        packed->r[idx] = max(lines->radius[l.x],lines->radius[l.y]) * _intersect_packed_slack;
+    }
+    return packed;
+}
+///@}
+
 range3f intersect_shape_bounds(Shape* shape) {
-    if(shape->_intersect_accelerator) return intersect_bvh_bounds(shape->_intersect_accelerator);
+    if(shape->_intersect_accelerator) return intersect_accelerator_bounds(shape->_intersect_accelerator);
     if(shape->_tesselation) return intersect_shape_bounds(shape->_tesselation);
     
     if(is<PointSet>(shape)) {
@@ -224,53 +380,68 @@ void intersect_shape_accelerate(Shape* shape) {
         shape->_intersect_accelerator = nullptr;
     }
     
-    if(shape->_tesselation) return intersect_shape_accelerate(shape->_tesselation);
+    if(shape->_tesselation) {
+        shape->_tesselation->intersect_accelerator_type = shape->intersect_accelerator_type;
+        return intersect_shape_accelerate(shape->_tesselation);
+    }
 
     if(is<PointSet>(shape)) {
         auto pointset = cast<PointSet>(shape);
         if(BVHAccelerator::min_prims > pointset->pos.size()) return;
         pointset->_intersect_accelerator =
-            new BVHAccelerator(pointset->pos.size(),
+            intersect_accelerator_new(shape->intersect_accelerator_type, pointset->pos.size(),
                                [pointset](int elementid){return intersect_pointset_element_bounds(pointset,elementid);},
                                [pointset](int elementid, const ray3f& ray, intersection3f& intersection){ return intersect_pointset_element_first(pointset,elementid,ray,intersection); },
                                [pointset](int elementid, const ray3f& ray){ return intersect_pointset_element_any(pointset,elementid,ray); });
-        intersect_bvh_accelerate(shape->_intersect_accelerator);
+        intersect_accelerator_build(shape->_intersect_accelerator);
+        if(is<BVHAccelerator>(shape->_intersect_accelerator)) {
+            auto bvh = cast<BVHAccelerator>(shape->_intersect_accelerator);
+            auto packed = _intersect_pack_pointset(pointset, bvh);
+            bvh->_intersect_leaf_cull = [packed](int start, int end, const ray3f& ray, int* candidates){
+                return _intersect_packed_leaf_cull<_PackedSpheres,_intersect_packed_spheres_cull>(*packed, start, end, ray, candidates); };
+        }
     } else if(is<LineSet>(shape)) {
         auto lines = cast<LineSet>(shape);
         if(BVHAccelerator::min_prims > lines->line.size()) return;
         lines->_intersect_accelerator =
-            new BVHAccelerator(lines->line.size(),
+            intersect_accelerator_new(shape->intersect_accelerator_type, lines->line.size(),
                                [lines](int elementid){return intersect_lineset_element_bounds(lines,elementid);},
                                [lines](int elementid, const ray3f& ray, intersection3f& intersection){ return intersect_lineset_element_first(lines,elementid,ray,intersection); },
                                [lines](int elementid, const ray3f& ray){ return intersect_lineset_element_any(lines,elementid,ray); });
-            intersect_bvh_accelerate(shape->_intersect_accelerator);
+        intersect_accelerator_build(shape->_intersect_accelerator);
+        if(is<BVHAccelerator>(shape->_intersect_accelerator)) {
+            auto bvh = cast<BVHAccelerator>(shape->_intersect_accelerator);
+            auto packed = _intersect_pack_lineset(lines, bvh);
+            bvh->_intersect_leaf_cull = [packed](int start, int end, const ray3f& ray, int* candidates){
+                return _intersect_packed_leaf_cull<_PackedCapsules,_intersect_packed_capsules_cull>(*packed, start, end, ray, candidates); };
+        }
     } else if(is<TriangleMesh>(shape)) {
         auto mesh = cast<TriangleMesh>(shape);
         if(BVHAccelerator::min_prims > mesh->triangle.size()) return;
         mesh->_intersect_accelerator =
-            new BVHAccelerator(mesh->triangle.size(),
+            intersect_accelerator_new(shape->intersect_accelerator_type, mesh->triangle.size(),
                                [mesh](int elementid){return intersect_trianglemesh_element_bounds(mesh,elementid);},
                                [mesh](int elementid, const ray3f& ray, intersection3f& intersection){ return intersect_trianglemesh_element_first(mesh,elementid,ray,intersection); },
                                [mesh](int elementid, const ray3f& ray){ return intersect_trianglemesh_element_any(mesh,elementid,ray); });
-        intersect_bvh_accelerate(shape->_intersect_accelerator);
+        intersect_accelerator_build(shape->_intersect_accelerator);
     } else if(is<Mesh>(shape)) {
         auto mesh = cast<Mesh>(shape);
-        if(BVHAccelerator::min_prims > mesh->triangle.size() + mesh->quad.size()*2) return;
+        if(BVHAccelerator::min_prims > mesh->triangle.size() + mesh->quad.size()) return;
         mesh->_intersect_accelerator =
-        new BVHAccelerator(mesh->triangle.size() + mesh->quad.size()*2,
+        intersect_accelerator_new(shape->intersect_accelerator_type, mesh->triangle.size() + mesh->quad.size(),
                            [mesh](int elementid){return intersect_mesh_element_bounds(mesh,elementid);},
                            [mesh](int elementid, const ray3f& ray, intersection3f& intersection){ return intersect_mesh_element_first(mesh,elementid,ray,intersection); },
                            [mesh](int elementid, const ray3f& ray){ return intersect_mesh_element_any(mesh,elementid,ray); });
-        intersect_bvh_accelerate(shape->_intersect_accelerator);
+        intersect_accelerator_build(shape->_intersect_accelerator);
     } else if(is<FaceMesh>(shape)) {
         auto mesh = cast<FaceMesh>(shape);
         if(BVHAccelerator::min_prims > mesh->triangle.size() + mesh->quad.size()) return;
         mesh->_intersect_accelerator =
-        new BVHAccelerator(mesh->triangle.size() + mesh->quad.size()*2,
+        intersect_accelerator_new(shape->intersect_accelerator_type, mesh->triangle.size() + mesh->quad.size(),
                            [mesh](int elementid){return intersect_facemesh_element_bounds(mesh,elementid);},
                            [mesh](int elementid, const ray3f& ray, intersection3f& intersection){ return intersect_facemesh_element_first(mesh,elementid,ray,intersection); },
                            [mesh](int elementid, const ray3f& ray){ return intersect_facemesh_element_any(mesh,elementid,ray); });
-        intersect_bvh_accelerate(shape->_intersect_accelerator);
+        intersect_accelerator_build(shape->_intersect_accelerator);
     }
 }
 
@@ -293,7 +464,7 @@ bool _intersect_element_first(int nelements, const function<bool(int,const ray3f
 }
 
 bool intersect_shape_first(Shape* shape, const ray3f& ray, intersection3f& intersection) {
-    if(shape->_intersect_accelerator) return intersect_bvh_first(shape->_intersect_accelerator,ray,intersection);
+    if(shape->_intersect_accelerator) return intersect_accelerator_first(shape->_intersect_accelerator,ray,intersection);
     if(shape->_tesselation) return intersect_shape_first(shape->_tesselation, ray, intersection);
     
     if(is<PointSet>(shape)) {
@@ -316,84 +487,88 @@ bool intersect_shape_first(Shape* shape, const ray3f& ray, intersection3f& inter
     }
     else if(is<Mesh>(shape)) {
         auto mesh = cast<Mesh>(shape);
-        return _intersect_element_first(mesh->triangle.size() + mesh->quad.size()*2,
+        return _intersect_element_first(mesh->triangle.size() + mesh->quad.size(),
                                         [mesh](int elementid, const ray3f& ray, intersection3f& intersection){ return intersect_mesh_element_first(mesh,elementid,ray,intersection); },
                                         ray, intersection);
     }
     else if(is<FaceMesh>(shape)) {
         auto mesh = cast<FaceMesh>(shape);
-        return _intersect_element_first(mesh->triangle.size() + mesh->quad.size()*2,
+        return _intersect_element_first(mesh->triangle.size() + mesh->quad.size(),
                                         [mesh](int elementid, const ray3f& ray, intersection3f& intersection){ return intersect_facemesh_element_first(mesh,elementid,ray,intersection); },
                                         ray, intersection);
     }
     else if(is<Sphere>(shape)) {
         auto sphere = cast<Sphere>(shape);
-        
+    
         float t;
         if(not intersect_sphere(ray, sphere->center, sphere->radius, t)) return false;
-        
+    
         intersection.ray_t = t;
         auto pl = (ray.eval(t) - sphere->center) / sphere->radius;
         intersection.uv = vec2f(atan2pos(pl.y,pl.x)/(2*pi),acos(pl.z)/pi);
-        
+    
         intersection.frame = sphere_frame(sphere, intersection.uv);
         intersection.geom_norm = intersection.frame.z;
         intersection.texcoord = intersection.uv;
-        
+        intersection.texcoord_density = 1 / (pi * sphere->radius * sqrt(2.0f));
+    
         return true;
     }
     else if(is<Cylinder>(shape)) {
         auto cylinder = cast<Cylinder>(shape);
-        
+    
         float t;
         if(not intersect_cylinder(ray, cylinder->radius, cylinder->height, t)) return false;
-        
+    
         intersection.ray_t = t;
-        
+    
         auto pl = ray.eval(t) / vec3f(cylinder->radius,cylinder->radius,cylinder->height);
         intersection.uv = vec2f(atan2pos(pl.y,pl.x)/(2*pi),pl.z);
-        
+    
         intersection.frame = cylinder_frame(cylinder, intersection.uv);
         intersection.geom_norm = intersection.frame.z;
         intersection.texcoord = intersection.uv;
-        
+        intersection.texcoord_density = 1 / sqrt(2 * pi * cylinder->radius * cylinder->height);
+    
         return true;
     }
     else if(is<Quad>(shape)) {
         auto quad = cast<Quad>(shape);
-        
+    
         float t; vec2f uv;
         if(not intersect_quad(ray, quad->width, quad->height, t, uv.x, uv.y)) return false;
-        
+    
         intersection.ray_t = t;
         intersection.uv = uv;
-        
+    
         intersection.frame = quad_frame(quad,intersection.uv);
         intersection.geom_norm = z3f;
         intersection.texcoord = uv;
-        
+        intersection.texcoord_density = 1 / sqrt(quad->width * quad->height);
+    
         return true;
     }
     else if(is<Triangle>(shape)) {
         auto triangle = cast<Triangle>(shape);
-        
+    
         float t; vec2f uv;
         if(not intersect_triangle(ray, triangle->v0, triangle->v1, triangle->v2, t, uv.x, uv.y)) return false;
-        
+    
         intersection.ray_t = t;
         intersection.uv = uv;
-        
+    
         intersection.frame = triangle_frame(triangle,intersection.uv);
         intersection.geom_norm = intersection.frame.z;
         intersection.texcoord = zero2f*uv.x+x2f*uv.y+y2f*(1-uv.x-uv.y);
-        
+        intersection.texcoord_density = sqrt(1 / length(cross(triangle->v1-triangle->v0, triangle->v2-triangle->v0)));
+    
         return true;
     }
     else { NOT_IMPLEMENTED_ERROR(); return false; }
 }
 
 bool intersect_shape_any(Shape* shape, const ray3f& ray) {
-    if(shape->_intersect_accelerator) return intersect_bvh_any(shape->_intersect_accelerator,ray);
+    if(shape->_intersect_accelerator) return intersect_accelerator_any(shape->_intersect_accelerator,ray);
     if(shape->_tesselation) return intersect_shape_any(shape->_tesselation, ray);
     
     if(is<PointSet>(shape)) {
@@ -412,12 +587,12 @@ bool intersect_shape_any(Shape* shape, const ray3f& ray) {
         return false;
     }
     else if(is<Mesh>(shape)) {
-        for(int i = 0; i < cast<Mesh>(shape)->triangle.size() + cast<Mesh>(shape)->quad.size()*2; i ++)
+        for(int i = 0; i < cast<Mesh>(shape)->triangle.size() + cast<Mesh>(shape)->quad.size(); i ++)
             if(intersect_mesh_element_any(cast<Mesh>(shape),i,ray)) return true;
         return false;
     }
     else if(is<FaceMesh>(shape)) {
-        for(int i = 0; i < cast<FaceMesh>(shape)->triangle.size() + cast<Mesh>(shape)->quad.size()*2; i ++)
+        for(int i = 0; i < cast<FaceMesh>(shape)->triangle.size() + cast<FaceMesh>(shape)->quad.size(); i ++)
             if(intersect_facemesh_element_any(cast<FaceMesh>(shape),i,ray)) return true;
         return false;
     }
@@ -454,12 +629,19 @@ bool intersect_primitive_first(Primitive* prim, const ray3f& ray, intersection3f
         auto transformed = cast<TransformedSurface>(prim);
         ERROR_IF_NOT(not transformed_animated(transformed), "intersect does not support animation");
         hit = intersect_shape_first(transformed->shape, transform_ray(transformed_matrix_inv(transformed,0), rayl),intersection);
-        if(hit) intersection = transform_intersection(transformed_matrix(transformed,0),transformed_matrix_inv(transformed,0),intersection);
+        if(hit) {
+            // the transform scales surface lengths by the square root of its area scaling in the tangent plane
+            auto m = transformed_matrix(transformed,0);
+            auto area_scale = length(cross(transform_vector(m,intersection.frame.x),transform_vector(m,intersection.frame.y)));
+            if(area_scale > 0) intersection.texcoord_density /= sqrt(area_scale);
+            intersection = transform_intersection(m,transformed_matrix_inv(transformed,0),intersection);
+        }
     }
     else NOT_IMPLEMENTED_ERROR();
     if(hit) {
         intersection = transform_intersection(prim->frame,intersection);
         intersection.material = prim->material;
+        intersection.prim = prim;
     }
     return hit;
 }
@@ -477,31 +659,149 @@ bool intersect_primitive_any(Primitive* prim, const ray3f& ray) {
 }
 
 
+///@name flattened analytic surfaces
+///@{
+/// Analytic surface baked in world space for the group bvh (tagged union)
+struct _FlatSurface {
+    enum { none, sphere, quad, cylinder } type = none; ///< shape type (none uses the generic primitive path)
+    frame3f         frame; ///< world frame
+    Shape*          shape = nullptr; ///< shape (for shading frames)
+    Material*       material = nullptr; ///< material
+    union {
+        struct { float cx, cy, cz, radius; } sphere; ///< world center and radius
+        struct { float width, height; } quad; ///< size
+        struct { float radius, height; } cylinder; ///< size
+    } params; ///< shape parameters
+};
+
+_FlatSurface _intersect_flatten_primitive(Primitive* prim) {
+    auto flat = _FlatSurface();
+    if(not is<Surface>(prim)) return flat;
+    auto shape = cast<Surface>(prim)->shape;
+    if(shape->_tesselation or shape->_intersect_accelerator) return flat;
+    flat.frame = prim->frame;
+    flat.shape = shape;
+    flat.material = prim->material;
+    if(is<Sphere>(shape)) {
+        auto c = transform_point(prim->frame, cast<Sphere>(shape)->center);
+        flat.type = _FlatSurface::sphere;
+        flat.params.sphere = { c.x, c.y, c.z, cast<Sphere>(shape)->radius };
+    } else if(is<Quad>(shape)) {
+        flat.type = _FlatSurface::quad;
+        flat.params.quad = { cast<Quad>(shape)->width, cast<Quad>(shape)->height };
+    } else if(is<Cylinder>(shape)) {
+        flat.type = _FlatSurface::cylinder;
+        flat.params.cylinder = { cast<Cylinder>(shape)->radius, cast<Cylinder>(shape)->height };
+    }
+    return flat;
+}
+
+// world-space ray-quad test, returns local plane coordinates
+bool _intersect_flat_quad(const _FlatSurface& flat, const ray3f& ray, float& t, vec2f& uv) {
+    auto dz = dot(ray.d, flat.frame.z);
+    if(dz == 0) return false;
+    t = dot(flat.frame.o - ray.e, flat.frame.z) / dz;
+    if(t < ray.tmin or t > ray.tmax) return false;
+    auto p = ray.eval(t) - flat.frame.o;
+    auto w = flat.params.quad.width, h = flat.params.quad.height;
+    uv = vec2f(dot(p, flat.frame.x), dot(p, flat.frame.y));
+    if(w/2 < uv.x or -w/2 > uv.x or h/2 < uv.y or -h/2 > uv.y) return false;
+    uv = vec2f(uv.x/w+0.5f, uv.y/h+0.5f);
+    return true;
+}
+
+bool intersect_flat_first(Primitive* prim, const _FlatSurface& flat, const ray3f& ray, intersection3f& intersection) {
+    switch(flat.type) {
+        case _FlatSurface::sphere: {
+            auto c = vec3f(flat.params.sphere.cx, flat.params.sphere.cy, flat.params.sphere.cz);
+            auto r = flat.params.sphere.radius;
+            float t;
+            if(not intersect_sphere(ray, c, r, t)) return false;
+            auto pl = transform_vector_inverse(flat.frame, ray.eval(t) - c) / r;
+            intersection.ray_t = t;
+            intersection.uv = vec2f(atan2pos(pl.y,pl.x)/(2*pi),acos(clamp(pl.z,-1.0f,1.0f))/pi);
+            intersection.frame = transform_frame(flat.frame, sphere_frame((Sphere*)flat.shape, intersection.uv));
+            intersection.geom_norm = intersection.frame.z;
+            intersection.texcoord = intersection.uv;
+            intersection.texcoord_density = 1 / (pi * r * sqrt(2.0f));
+        } break;
+        case _FlatSurface::quad: {
+            float t; vec2f uv;
+            if(not _intersect_flat_quad(flat, ray, t, uv)) return false;
+            intersection.ray_t = t;
+            intersection.uv = uv;
+            intersection.frame = transform_frame(flat.frame, quad_frame((Quad*)flat.shape, uv));
+            intersection.geom_norm = flat.frame.z;
+            intersection.texcoord = uv;
+            intersection.texcoord_density = 1 / sqrt(flat.params.quad.width * flat.params.quad.height);
+        } break;
+        case _FlatSurface::cylinder: {
+            // the quadratic depends on the axis, so the ray is still brought to the cylinder frame
+            auto rayl = transform_ray_inverse(flat.frame, ray);
+            auto r = flat.params.cylinder.radius, h = flat.params.cylinder.height;
+            float t;
+            if(not intersect_cylinder(rayl, r, h, t)) return false;
+            auto pl = rayl.eval(t) / vec3f(r,r,h);
+            intersection.ray_t = t;
+            intersection.uv = vec2f(atan2pos(pl.y,pl.x)/(2*pi),pl.z);
+            intersection.frame = transform_frame(flat.frame, cylinder_frame((Cylinder*)flat.shape, intersection.uv));
+            intersection.geom_norm = intersection.frame.z;
+            intersection.texcoord = intersection.uv;
+            intersection.texcoord_density = 1 / sqrt(2 * pi * r * h);
+        } break;
+        default: return intersect_primitive_first(prim, ray, intersection);
+    }
+    intersection.material = flat.material;
+    intersection.prim = prim;
+    return true;
+}
+
+bool intersect_flat_any(Primitive* prim, const _FlatSurface& flat, const ray3f& ray) {
+    switch(flat.type) {
+        case _FlatSurface::sphere:
+            return intersect_sphere(ray, vec3f(flat.params.sphere.cx, flat.params.sphere.cy, flat.params.sphere.cz), flat.params.sphere.radius);
+        case _FlatSurface::quad: { float t; vec2f uv; return _intersect_flat_quad(flat, ray, t, uv); }
+        case _FlatSurface::cylinder:
+            return intersect_cylinder(transform_ray_inverse(flat.frame, ray), flat.params.cylinder.radius, flat.params.cylinder.height);
+        default: return intersect_primitive_any(prim, ray);
+    }
+}
+///@}
+
 range3f intersect_primitives_bounds(PrimitiveGroup* group) {
-    if(group->_intersect_accelerator) return intersect_bvh_bounds(group->_intersect_accelerator);
+    if(group->_intersect_accelerator) return intersect_accelerator_bounds(group->_intersect_accelerator);
     range3f bbox;
     for(auto p : group->prims) bbox = runion(bbox,intersect_primitive_bounds(p));
     return bbox;
 }
 
 void intersect_primitives_accelerate(PrimitiveGroup* group) {
-    for(auto p : group->prims) intersect_primitive_accelerate(p);
+    // shapes shared by several primitives are accelerated once
+    std::unordered_set<Shape*> shapes;
+    for(auto p : group->prims) {
+        if(shapes.insert(primitive_shape(p)).second) intersect_primitive_accelerate(p);
+    }
     if(group->_intersect_accelerator) { delete group->_intersect_accelerator; group->_intersect_accelerator = nullptr; }
     if(group->intersect_accelerator_use and BVHAccelerator::min_prims < group->prims.size()) {
-        vector<range3f> bboxes;
-        for(auto p : group->prims) bboxes.push_back(intersect_primitive_bounds(p));
-        auto bvh = new BVHAccelerator(group->prims.size(),
+        auto flat = make_shared<vector<_FlatSurface>>();
+        for(auto p : group->prims) flat->push_back(_intersect_flatten_primitive(p));
+        auto accelerator = intersect_accelerator_new(group->intersect_accelerator_type, group->prims.size(),
                                       [group](int elementid){ return intersect_primitive_bounds(group->prims[elementid]); },
-                                      [group](int elementid, const ray3f& ray, intersection3f& intersection){ return intersect_primitive_first(group->prims[elementid], ray, intersection); },
-                                      [group](int elementid, const ray3f& ray){ return intersect_primitive_any(group->prims[elementid], ray); } );
-        intersect_bvh_accelerate(bvh);
-        group->_intersect_accelerator = bvh;
+                                      [group,flat](int elementid, const ray3f& ray, intersection3f& intersection){ return intersect_flat_first(group->prims[elementid], (*flat)[elementid], ray, intersection); },
+                                      [group,flat](int elementid, const ray3f& ray){ return intersect_flat_any(group->prims[elementid], (*flat)[elementid], ray); } );
+        accelerator->_intersect_elem_update = [group,flat](int elementid){ (*flat)[elementid] = _intersect_flatten_primitive(group->prims[elementid]); };
+        intersect_accelerator_build(accelerator);
+        group->_intersect_accelerator = accelerator;
     }
 }
 
+void intersect_primitives_update(PrimitiveGroup* group, int primid) {
+    if(group->_intersect_accelerator) intersect_accelerator_update(group->_intersect_accelerator, primid);
+}
+
 bool intersect_primitives_first(PrimitiveGroup* group, const ray3f& ray, intersection3f& intersection) {
     bool hit = false;
-    if(group->_intersect_accelerator) hit = intersect_bvh_first(group->_intersect_accelerator,ray,intersection);
+    if(group->_intersect_accelerator) hit = intersect_accelerator_first(group->_intersect_accelerator,ray,intersection);
     else {
         float mint = ray3f::rayinf;
         ray3f sray = ray;
@@ -521,14 +821,92 @@ bool intersect_primitives_first(PrimitiveGroup* group, const ray3f& ray, interse
 }
 
 bool intersect_primitives_any(PrimitiveGroup* group, const ray3f& ray) {
-    if(group->_intersect_accelerator) return intersect_bvh_any(cast<BVHAccelerator>(group->_intersect_accelerator),ray);
+    if(group->_intersect_accelerator) return intersect_accelerator_any(group->_intersect_accelerator,ray);
     for(auto p : group->prims) if(intersect_primitive_any(p,ray)) return true;
     return false;
 }
 
+///@name occlusion with last occluder cache
+///@{
+const int _occluder_cache_size = 16; ///< occluder cache slots (direct mapped by light)
+
+/// Last occluding primitive per light, kept per thread
+struct _OccluderCache {
+    const void*         key[_occluder_cache_size]; ///< slot light
+    int                 occluder[_occluder_cache_size]; ///< slot occluding primitive (-1 for none)
+    
+    /// Constructor (empty slots)
+    _OccluderCache() { for(auto i : range(_occluder_cache_size)) { key[i] = nullptr; occluder[i] = -1; } }
+};
+
+thread_local _OccluderCache _occluder_cache; ///< per-thread occluder cache
+thread_local ShadowStats _shadow_stats; ///< per-thread shadow ray counters
+ShadowStats _shadow_stats_total; ///< merged shadow ray counters
+std::mutex _shadow_stats_mutex; ///< lock for merged counters
+
+// tests the cached occluder first, then the group; keeps the occluder found (if any)
+bool intersect_primitives_occluded(PrimitiveGroup* group, const ray3f& ray, int& occluder) {
+    auto accelerator = group->_intersect_accelerator;
+    if(occluder >= 0 and occluder < group->prims.size()) {
+        auto hit = (accelerator) ? accelerator->_intersect_elem_any(occluder, ray) : intersect_primitive_any(group->prims[occluder], ray);
+        if(hit) { _shadow_stats.cache_hits ++; return true; }
+    }
+    if(accelerator) {
+        if(intersect_accelerator_any(accelerator, ray, occluder)) return true;
+    } else {
+        for(auto i : range(group->prims.size())) {
+            if(intersect_primitive_any(group->prims[i], ray)) { occluder = i; return true; }
+        }
+    }
+    // unoccluded rays tend to be followed by unoccluded rays, so skip the cache until the next hit
+    occluder = -1;
+    return false;
+}
+
+bool intersect_scene_occluded(Scene* scene, const ray3f& ray, Light* light) {
+    auto slot = (int)(((size_t)light >> 4) % _occluder_cache_size);
+    if(_occluder_cache.key[slot] != light) {
+        _occluder_cache.key[slot] = light;
+        _occluder_cache.occluder[slot] = -1;
+    }
+    _shadow_stats.rays ++;
+    auto hit = intersect_primitives_occluded(scene->prims, ray, _occluder_cache.occluder[slot]);
+    if(hit) _shadow_stats.occluded ++;
+    return hit;
+}
+
+void intersect_scene_first_batch(Scene* scene, int count, const vec3f* ray_e, const vec3f* ray_d, intersection3f* intersections, char* hits) {
+    for(auto i : range(count)) hits[i] = intersect_scene_first(scene, ray3f(ray_e[i], ray_d[i]), intersections[i]);
+}
+
+void intersect_scene_occluded_batch(Scene* scene, int count, const vec3f* ray_e, const vec3f* ray_d, const float* ray_tmax, Light* const* lights, char* occluded) {
+    for(auto i : range(count)) occluded[i] = intersect_scene_occluded(scene, ray3f(ray_e[i], ray_d[i], ray3f::epsilon, ray_tmax[i]), lights[i]);
+}
+
+void intersect_shadow_stats_flush() {
+    std::lock_guard<std::mutex> lock(_shadow_stats_mutex);
+    _shadow_stats_total.rays += _shadow_stats.rays;
+    _shadow_stats_total.occluded += _shadow_stats.occluded;
+    _shadow_stats_total.cache_hits += _shadow_stats.cache_hits;
+    _shadow_stats = ShadowStats();
+}
+
+ShadowStats intersect_shadow_stats() {
+    std::lock_guard<std::mutex> lock(_shadow_stats_mutex);
+    return _shadow_stats_total;
+}
+
+void intersect_shadow_stats_reset() {
+    std::lock_guard<std::mutex> lock(_shadow_stats_mutex);
+    _shadow_stats_total = ShadowStats();
+    _shadow_stats = ShadowStats();
+}
+///@}
+
 
 
 void intersect_scene_accelerate(Scene* scene) { intersect_primitives_accelerate(scene->prims); }
+void intersect_scene_update(Scene* scene, int primid) { intersect_primitives_update(scene->prims, primid); }
 range3f intersect_scene_bounds(Scene* scene) { return intersect_primitives_bounds(scene->prims); }
 
 bool intersect_scene_first(Scene* scene, const ray3f& ray, intersection3f& intersection) { return intersect_primitives_first(scene->prims, ray, intersection); }
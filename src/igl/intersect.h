@@ -12,6 +12,8 @@
 struct Material;
 struct Scene;
 struct Shape;
+struct Light;
+struct Primitive;
 
 /// intersection record
 struct intersection3f {
@@ -20,7 +22,9 @@ struct intersection3f {
 	vec3f                   geom_norm; ///< intersection geometric normal
 	vec2f                   uv; ///< intersection shape uv
 	vec2f                   texcoord; ///< intersection texcoord
+	float                   texcoord_density = 0; ///< texcoord length per unit of surface length (0 if unknown)
 	Material*               material; ///< intersection material
+	Primitive*              prim = nullptr; ///< intersected primitive
 };
 
 /// transform an intersection elements by a frame
@@ -42,15 +46,35 @@ inline intersection3f transform_intersection(const mat4f& m, const mat4f& mi, co
 ///@name intersection interface
 ///@{
 void intersect_scene_accelerate(Scene* scene);
+void intersect_scene_update(Scene* scene, int primid);
 range3f intersect_scene_bounds(Scene* scene);
 
 bool intersect_scene_first(Scene* scene, const ray3f& ray, intersection3f& intersection);
 bool intersect_scene_any(Scene* scene, const ray3f& ray);
+bool intersect_scene_occluded(Scene* scene, const ray3f& ray, Light* light);
+
+/// first hits of count rays given as origin and direction arrays (for wavefront integrators)
+void intersect_scene_first_batch(Scene* scene, int count, const vec3f* ray_e, const vec3f* ray_d, intersection3f* intersections, char* hits);
+/// occlusion of count shadow rays towards lights; rays towards the same light are best kept together for the occluder cache
+void intersect_scene_occluded_batch(Scene* scene, int count, const vec3f* ray_e, const vec3f* ray_d, const float* ray_tmax, Light* const* lights, char* occluded);
 
 bool intersect_shape_first(Shape* shape, const ray3f& ray, intersection3f& intersection);
 void intersect_shape_accelerate(Shape* shape);
+range3f intersect_shape_bounds(Shape* shape);
+///@}
 
+/// shadow ray statistics
+struct ShadowStats {
+    long long           rays = 0; ///< shadow rays traced
+    long long           occluded = 0; ///< shadow rays occluded
+    long long           cache_hits = 0; ///< shadow rays occluded by the cached last occluder
+};
 
+///@name shadow ray statistics interface
+///@{
+void intersect_shadow_stats_flush();
+ShadowStats intersect_shadow_stats();
+void intersect_shadow_stats_reset();
 ///@}
 
 ///@}
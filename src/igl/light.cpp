@@ -1,3 +1,150 @@
 #include "light.h"
+#include "intersect.h"
+
+#include <algorithm>
 
 ///@file igl/light.cpp Lights. @ingroup igl
+
+range3f arealight_bounds(AreaLight* light) {
+    return transform_bbox(light->frame, intersect_shape_bounds(light->shape));
+}
+
+// cone bounding the directions of two cones
+void _light_cone_union(vec3f& axis, float& theta, const vec3f& axis_b, float theta_b) {
+    if(theta_b > theta) {
+        auto axis_a = axis; auto theta_a = theta;
+        axis = axis_b; theta = theta_b;
+        _light_cone_union(axis, theta, axis_a, theta_a);
+        return;
+    }
+    auto theta_d = acos(clamp(dot(axis, axis_b), -1.0f, 1.0f));
+    if(min(theta_d + theta_b, pif) <= theta) return;
+    auto theta_u = (theta + theta_d + theta_b) / 2;
+    if(theta_u >= pif) { theta = pif; return; }
+    // rotate the axis towards b so that the new cone touches both cones
+    auto ortho = axis_b - axis * dot(axis, axis_b);
+    if(lengthSqr(ortho) < 1e-12f) { theta = pif; return; }
+    auto rot = theta_u - theta;
+    axis = normalize(axis * cos(rot) + normalize(ortho) * sin(rot));
+    theta = theta_u;
+}
+
+// bvh leaf of a local light
+LightBVHNode _light_bvh_leaf(LightGroup* lights, int idx) {
+    auto light = lights->lights[idx];
+    auto node = LightBVHNode();
+    node.light = idx;
+    node.power = light_power(light);
+    if(is<AreaLight>(light)) {
+        auto area = cast<AreaLight>(light);
+        node.bbox = area->_bounds;
+        node.cos_theta_e = 0;
+        // flat one sided shapes emit around their normal, the others in all directions
+        if(is<Quad>(area->shape) and not area->doublesided) {
+            node.axis = light->frame.z;
+            node.cos_theta_o = 1;
+        } else if(is<Triangle>(area->shape) and not area->doublesided) {
+            auto triangle = cast<Triangle>(area->shape);
+            node.axis = transform_direction(light->frame, triangle_normal(triangle->v0, triangle->v1, triangle->v2));
+            node.cos_theta_o = 1;
+        } else node.cos_theta_o = -1;
+    } else {
+        node.bbox = range3f(light->frame.o, light->frame.o);
+        node.cos_theta_o = -1;
+        node.cos_theta_e = 0;
+    }
+    return node;
+}
+
+// builds the bvh over leaves [start,end), splitting at the median of the longest axis of the centers
+int _light_bvh_build(vector<LightBVHNode>& nodes, vector<LightBVHNode>& leaves, int start, int end) {
+    if(end - start == 1) { nodes.push_back(leaves[start]); return nodes.size()-1; }
+    auto cbox = range3f();
+    for(auto i = start; i < end; i ++) cbox = runion(cbox, center(leaves[i].bbox));
+    auto csize = size(cbox);
+    auto axis = (csize.x >= csize.y and csize.x >= csize.z) ? 0 : ((csize.y >= csize.z) ? 1 : 2);
+    auto mid = (start + end) / 2;
+    std::nth_element(leaves.begin()+start, leaves.begin()+mid, leaves.begin()+end,
+                     [axis](const LightBVHNode& a, const LightBVHNode& b) { return center(a.bbox)[axis] < center(b.bbox)[axis]; });
+    auto nid = (int)nodes.size();
+    nodes.push_back(LightBVHNode());
+    auto n0 = _light_bvh_build(nodes, leaves, start, mid);
+    auto n1 = _light_bvh_build(nodes, leaves, mid, end);
+    auto& node = nodes[nid];
+    node.n0 = n0; node.n1 = n1;
+    node.bbox = runion(nodes[n0].bbox, nodes[n1].bbox);
+    node.power = nodes[n0].power + nodes[n1].power;
+    node.axis = nodes[n0].axis;
+    auto theta_o = acos(nodes[n0].cos_theta_o);
+    _light_cone_union(node.axis, theta_o, nodes[n1].axis, acos(nodes[n1].cos_theta_o));
+    node.cos_theta_o = cos(theta_o);
+    node.cos_theta_e = min(nodes[n0].cos_theta_e, nodes[n1].cos_theta_e);
+    return nid;
+}
+
+void light_selection_init(LightGroup* lights) {
+    lights->_local.clear();
+    lights->_bvh.clear();
+    for(auto i : range(lights->lights.size())) if(light_is_local(lights->lights[i])) lights->_local.push_back(i);
+    if(lights->_local.empty()) return;
+    auto power = vector<float>();
+    auto leaves = vector<LightBVHNode>();
+    for(auto idx : lights->_local) {
+        power.push_back(light_power(lights->lights[idx]));
+        leaves.push_back(_light_bvh_leaf(lights, idx));
+    }
+    lights->_power_distribution = sample_init_distribution1d(power);
+    lights->_bvh.reserve(2*leaves.size());
+    _light_bvh_build(lights->_bvh, leaves, 0, leaves.size());
+}
+
+// cosine of max(0, theta_a - theta_b) from the angles cosines
+inline float _light_cos_sub_clamped(float cos_a, float cos_b) {
+    if(cos_a >= cos_b) return 1;
+    return cos_a * cos_b + sqrt(max(0.0f, 1 - cos_a*cos_a)) * sqrt(max(0.0f, 1 - cos_b*cos_b));
+}
+
+// estimated contribution of a bvh node at p with normal n: power over squared distance,
+// times conservative bounds on the emitter and receiver cosines (computed without trigonometric calls)
+float _light_bvh_importance(const LightBVHNode& node, const vec3f& p, const vec3f& n) {
+    if(node.power <= 0) return 0;
+    auto d = p - center(node.bbox);
+    auto dist2 = lengthSqr(d);
+    auto radius2 = lengthSqr(size(node.bbox)) / 4;
+    // inside the bounds (or close) every direction is possible, and the distance is not reliable
+    if(dist2 <= radius2) return node.power / max(radius2, 1e-8f);
+    auto wi = d / sqrt(dist2);
+    // angle subtended by the bounds
+    auto cos_theta_b = sqrt(1 - radius2 / dist2);
+    // emitter: angle of p to the normals cone, reduced by the bounds extent
+    auto cos_theta_x = _light_cos_sub_clamped(dot(node.axis, wi), node.cos_theta_o);
+    auto cos_theta_p = _light_cos_sub_clamped(cos_theta_x, cos_theta_b);
+    if(cos_theta_p <= node.cos_theta_e) return 0;
+    // receiver: angle of the bounds to the normal
+    auto cos_i = 1.0f;
+    if(not (n == zero3f)) {
+        cos_i = _light_cos_sub_clamped(-dot(n, wi), cos_theta_b);
+        if(cos_i <= 0) return 0;
+    }
+    return node.power * cos_theta_p * cos_i / dist2;
+}
+
+IndexSample light_select_bvh(LightGroup* lights, const vec3f& p, const vec3f& n, float u) {
+    IndexSample is;
+    if(lights->_bvh.empty()) return is;
+    auto nid = 0;
+    auto pmf = 1.0f;
+    while(lights->_bvh[nid].light < 0) {
+        auto& node = lights->_bvh[nid];
+        auto i0 = _light_bvh_importance(lights->_bvh[node.n0], p, n);
+        auto i1 = _light_bvh_importance(lights->_bvh[node.n1], p, n);
+        if(i0 + i1 <= 0) return is;
+        auto p0 = i0 / (i0 + i1);
+        // reuse u for the next choice by remapping it within the chosen interval
+        if(u < p0) { nid = node.n0; pmf *= p0; u = min(u / p0, 0.999999f); }
+        else { nid = node.n1; pmf *= 1 - p0; u = min((u - p0) / (1 - p0), 0.999999f); }
+    }
+    is.idx = lights->_bvh[nid].light;
+    is.pdf = pmf;
+    return is;
+}
@@ -39,6 +39,9 @@ struct AreaLight : Light {
     vec3f               intensity = one3f; ///< intensity
     Shape*              shape = nullptr; ///< light shape (should support sampling)
     int                 shadow_samples = 16; ///< number of shadow rays
+    bool                doublesided = false; ///< whether the shape emits on both sides (otherwise along its normals)
+    
+    range3f             _bounds; ///< world bounds of the light shape (set by sample_light_init)
 };
 
 /// Environment Light based on an infinite sphere
@@ -50,8 +53,22 @@ struct EnvLight : Light {
     bool                hemisphere = false; ///< hemisphere only
     int                 shadow_samples = 16; ///< number of shadow rays
     bool                importance_sampling = true; ///< whether to use importance sampling for the texture
+    bool                irradiance_sh = false; ///< whether to shade diffuse with prefiltered irradiance instead of shadow rays
+    int                 occlusion_samples = 4; ///< number of occlusion rays scaling the prefiltered irradiance
     
     Distribution2D*     _importance_distribution = nullptr; ///< whether to use importance sampling
+    vector<vec3f>       _irradiance_sh; ///< irradiance spherical harmonics in the light frame (order 2, cosine convolved)
+};
+
+/// Light BVH node, bounding positions, power and emission directions of its lights (Conty Estevez and Kulla)
+struct LightBVHNode {
+    range3f             bbox; ///< bounding box of the light positions
+    float               power = 0; ///< total emitted power
+    vec3f               axis = z3f; ///< axis of the cone bounding the light normals
+    float               cos_theta_o = -1; ///< cosine of the half angle of the cone bounding the light normals
+    float               cos_theta_e = 1; ///< cosine of the angle of emission around the normals
+    int                 light = -1; ///< for leaves: light index (-1 for internal nodes)
+    int                 n0 = -1, n1 = -1; ///< for internal: left and right node
 };
 
 /// Group of Lights
@@ -59,32 +76,164 @@ struct LightGroup : Node {
     REGISTER_FAST_RTTI(Node,LightGroup,7)
     
     vector<Light*>      lights;
+    
+    vector<int>         _local; ///< lights with a position (point and area), the ones that can be selected stochastically
+    Distribution1D      _power_distribution; ///< local lights distribution by power
+    vector<LightBVHNode> _bvh; ///< light bvh over the local lights (root first)
 };
 
-///@name sample interface
-/// requsted number of shadow rays
-inline int light_shadow_nsamples(Light* light) {
-    if(is<AreaLight>(light)) return cast<AreaLight>(light)->shadow_samples;
-    else if(is<EnvLight>(light)) return cast<EnvLight>(light)->shadow_samples;
-    else return 1;
-}
-
 /// Shadow Sample
 struct ShadowSample {
     vec3f           radiance; ///< light radiance
     vec3f           dir; ///< light direction
     float           dist; ///< light distance
     float           pdf; ///< sample pdf
+    float           pdf_solidangle; ///< pdf of the sampled direction per solid angle (0 for delta lights)
 };
 
-/// shadow ray and radiance for light center
+///@name envmap interface
+/// latitude-longitude texture coordinates of a direction in the light frame (z up)
+inline vec2f envlight_texcoord(const vec3f& wl) {
+    auto phi = atan2(wl.y, wl.x);
+    if(phi < 0) phi += 2*pif;
+    return vec2f(phi / (2*pif), acos(clamp(wl.z,-1.0f,1.0f)) / pif);
+}
+
+/// direction in the light frame of latitude-longitude texture coordinates
+inline vec3f envlight_direction(const vec2f& uv) {
+    auto phi = 2*pif*uv.x, theta = pif*uv.y;
+    return vec3f(sin(theta)*cos(phi), sin(theta)*sin(phi), cos(theta));
+}
+
+/// envlight radiance from a direction in the light frame
+/// (nearest lookup, so that radiance and importance distribution are piecewise constant over the same texels)
+inline vec3f envlight_radiance(EnvLight* env, const vec3f& wl) {
+    if(env->hemisphere and wl.z <= 0) return zero3f;
+    if(not env->envmap) return env->intensity;
+    return env->intensity * texture_lookup_nearest(env->envmap, envlight_texcoord(wl));
+}
+
+/// samples a direction in the light frame, following the envmap if importance sampling is enabled
+inline DirectionSample envlight_sample_direction(EnvLight* env, const vec2f& sample) {
+    if(env->_importance_distribution) {
+        auto ds = sample_distribution2d(env->_importance_distribution, sample);
+        DirectionSample ret;
+        ret.dir = envlight_direction(ds.value);
+        // lat-long to solid angle: dw = 2 pi^2 sin(theta) du dv
+        auto sinTheta = sin(pif*ds.value.y);
+        ret.pdf = (sinTheta > 0) ? ds.pdf / (2*pif*pif*sinTheta) : 0;
+        return ret;
+    }
+    return (env->hemisphere) ? sample_direction_hemispherical(sample) : sample_direction_spherical(sample);
+}
+
+/// solid angle pdf of envlight_sample_direction() for a direction in the light frame
+inline float envlight_sample_direction_pdf(EnvLight* env, const vec3f& wl) {
+    if(env->hemisphere and wl.z <= 0) return 0;
+    if(env->_importance_distribution) {
+        auto sinTheta = sqrt(max(0.0f, 1-wl.z*wl.z));
+        if(sinTheta <= 0) return 0;
+        return sample_distribution2d_pdf(env->_importance_distribution, envlight_texcoord(wl)) / (2*pif*pif*sinTheta);
+    }
+    return (env->hemisphere) ? sample_direction_hemispherical_pdf(wl) : sample_direction_spherical_pdf(wl);
+}
+
+/// real spherical harmonics basis up to order 2 (9 values)
+inline void _sh_basis9(const vec3f& d, float* y) {
+    y[0] = 0.282095f;
+    y[1] = 0.488603f * d.y; y[2] = 0.488603f * d.z; y[3] = 0.488603f * d.x;
+    y[4] = 1.092548f * d.x * d.y; y[5] = 1.092548f * d.y * d.z; y[6] = 0.315392f * (3 * d.z * d.z - 1);
+    y[7] = 1.092548f * d.x * d.z; y[8] = 0.546274f * (d.x * d.x - d.y * d.y);
+}
+
+/// projects the envlight radiance on spherical harmonics and convolves it with the clamped cosine
+/// (Ramamoorthi and Hanrahan), integrating over the envmap texels (or a 64x32 grid without envmap)
+inline vector<vec3f> envlight_irradiance_sh_init(EnvLight* env) {
+    auto w = 64, h = 32;
+    if(env->envmap and not env->envmap->_levels.empty()) { w = env->envmap->_levels[0].width; h = env->envmap->_levels[0].height; }
+    vector<vec3f> sh(9, zero3f);
+    float y[9];
+    for(auto j : range(h)) {
+        auto dw = 2 * pif * pif * sin(pif * (j+0.5f) / h) / (w * h);
+        for(auto i : range(w)) {
+            auto wl = envlight_direction(vec2f((i+0.5f)/w, (j+0.5f)/h));
+            auto le = envlight_radiance(env, wl);
+            if(le == zero3f) continue;
+            _sh_basis9(wl, y);
+            for(auto k : range(9)) sh[k] += le * (y[k] * dw);
+        }
+    }
+    const float band[9] = { pif, 2*pif/3, 2*pif/3, 2*pif/3, pif/4, pif/4, pif/4, pif/4, pif/4 };
+    for(auto k : range(9)) sh[k] *= band[k];
+    return sh;
+}
+
+/// unshadowed irradiance from the envlight on a surface with world normal n (requires irradiance_sh)
+inline vec3f envlight_irradiance(EnvLight* env, const vec3f& n) {
+    if(env->_irradiance_sh.empty()) return zero3f;
+    float y[9];
+    _sh_basis9(transform_direction_inverse(env->frame, n), y);
+    auto e = zero3f;
+    for(auto k : range(9)) e += env->_irradiance_sh[k] * y[k];
+    // order 2 ringing can go slightly negative opposite to bright lights
+    return max(e, 0.0f);
+}
+///@}
+
+///@name area light interface
+/// samples the cone subtended by an area light sphere from pl (in the light frame, outside the sphere);
+/// the sample at the origin is the cone axis
+inline ShadowSample _arealight_sample_sphere(AreaLight* light, const vec3f& pl, const vec2f& sample) {
+    auto sphere = cast<Sphere>(light->shape);
+    auto wc = sphere->center - pl;
+    auto dc = length(wc);
+    wc /= dc;
+    auto r2 = sphere->radius * sphere->radius;
+    auto sin2_max = r2 / (dc * dc);
+    auto cos_max = sqrt(max(0.0f, 1 - sin2_max));
+    // 1 - cos_max, accurate for small cones
+    auto cone = sin2_max / (1 + cos_max);
+    auto cos_t = 1 - sample.x * cone;
+    auto sin_t = sqrt(max(0.0f, 1 - cos_t*cos_t));
+    auto phi = 2 * pif * sample.y;
+    auto bx = normalize(cross((abs(wc.z) < 0.9f) ? z3f : x3f, wc));
+    auto by = cross(wc, bx);
+    ShadowSample ss;
+    ss.dir = bx * (sin_t * cos(phi)) + by * (sin_t * sin(phi)) + wc * cos_t;
+    ss.dist = dc * cos_t - sqrt(max(0.0f, r2 - dc * dc * sin_t * sin_t));
+    ss.radiance = light->intensity;
+    ss.pdf = 1 / (2 * pif * cone);
+    ss.pdf_solidangle = ss.pdf;
+    return ss;
+}
+
+/// area of an area light shape
+inline float arealight_area(AreaLight* light) { return shape_sample_uniform(light->shape, vec2f(0.5f,0.5f)).area; }
+
+/// world bounds of an area light shape
+range3f arealight_bounds(AreaLight* light);
+
+/// solid angle subtended at p by the sphere bounding the light (uses the bounds from sample_light_init)
+inline float arealight_solidangle(AreaLight* light, const vec3f& p) {
+    auto r2 = lengthSqr(size(light->_bounds)) / 4;
+    auto d2 = lengthSqr(p - center(light->_bounds));
+    if(d2 <= r2) return 2 * pif;
+    auto sin2_max = r2 / d2;
+    return 2 * pif * sin2_max / (1 + sqrt(1 - sin2_max));
+}
+///@}
+
+///@name sample interface
+/// requsted number of shadow rays
+inline int light_shadow_nsamples(Light* light) {
+    if(is<AreaLight>(light)) return cast<AreaLight>(light)->shadow_samples;
+    else if(is<EnvLight>(light)) return cast<EnvLight>(light)->shadow_samples;
+    else return 1;
+}
+
+/// shadow ray and radiance for light center, or for a light sample if is_montecarlo (area and env lights)
 inline ShadowSample light_shadow_sample(Light* light, const vec3f& p, const vec2f& sample, const bool is_montecarlo) {
     auto frame = light->frame;
-    if(is_montecarlo) {
-        auto l = cast<AreaLight>(light);
-        auto quad = cast<Quad>(l->shape);
-        frame.o += (sample.x - 0.5) * frame.x * quad->width + (sample.y - 0.5) * frame.y * quad->height;
-    }
     auto pl = transform_point_inverse(frame, p);
     ShadowSample ss;
     if(is<PointLight>(light)) {
@@ -92,67 +241,149 @@ inline ShadowSample light_shadow_sample(Light* light, const vec3f& p, const vec2
         ss.dist = length(pl);
         ss.radiance = cast<PointLight>(light)->intensity / lengthSqr(pl);
         ss.pdf = 1;
+        ss.pdf_solidangle = 0;
     }
     else if(is<DirectionalLight>(light)) {
         ss.dir = -z3f;
         ss.dist = ray3f::rayinf;
         ss.radiance = cast<DirectionalLight>(light)->intensity;
         ss.pdf = 1;
+        ss.pdf_solidangle = 0;
     }
     else if(is<AreaLight>(light)) {
         // For soft shadows
         auto l = cast<AreaLight>(light);
-        auto quad = cast<Quad>(l->shape);
-
-        ss.dir = normalize(-pl);
-        ss.dist = length(pl);
-        ss.radiance = dot(ss.dir, frame.z) * l->intensity / lengthSqr(pl);
-        ss.pdf = 1/(quad->width * quad->height);
+        auto sphere = (is<Sphere>(l->shape)) ? cast<Sphere>(l->shape) : nullptr;
+        if(sphere and lengthSqr(pl - sphere->center) > sphere->radius * sphere->radius) {
+            ss = _arealight_sample_sphere(l, pl, (is_montecarlo) ? sample : zero2f);
+        } else {
+            // uniform point on the shape (its center without Monte Carlo)
+            auto sss = shape_sample_uniform(l->shape, (is_montecarlo) ? sample : vec2f(0.5f,0.5f));
+            auto d = sss.frame.o - pl;
+            ss.dist = length(d);
+            ss.dir = d / ss.dist;
+            auto cos_l = -dot(ss.dir, sss.frame.z);
+            if(l->doublesided) cos_l = abs(cos_l);
+            ss.radiance = max(cos_l, 0.0f) * l->intensity / (ss.dist*ss.dist);
+            ss.pdf = 1/sss.area;
+            ss.pdf_solidangle = (cos_l > 0) ? ss.pdf * ss.dist * ss.dist / cos_l : 0;
+        }
     }
     else if(is<EnvLight>(light)) {
-        ss.dir = normalize(-pl);
+        auto env = cast<EnvLight>(light);
         ss.dist = ray3f::rayinf;
-        ss.radiance = cast<EnvLight>(light)->intensity * pif;
-        ss.pdf = 1;
+        if(is_montecarlo) {
+            auto ds = envlight_sample_direction(env, sample);
+            ss.dir = ds.dir;
+            ss.radiance = (ds.pdf > 0) ? envlight_radiance(env, ds.dir) : zero3f;
+            ss.pdf = (ds.pdf > 0) ? ds.pdf : 1;
+            ss.pdf_solidangle = ds.pdf;
+        } else {
+            ss.dir = normalize(-pl);
+            ss.radiance = env->intensity * pif;
+            ss.pdf = 1;
+            ss.pdf_solidangle = 0;
+        }
     }
-    else { NOT_IMPLEMENTED_ERROR(); }
+    else NOT_IMPLEMENTED_ERROR();
     ss.dir = transform_direction(light->frame, ss.dir);
     return ss;
 }
 
+/// solid angle pdf of light_shadow_sample choosing the direction wi from p, reaching the light at distance dist
+/// on a surface with normal n (area lights); zero for delta lights and for directions the light does not emit to
+inline float light_shadow_sample_pdf(Light* light, const vec3f& p, const vec3f& wi, float dist, const vec3f& n) {
+    if(is<AreaLight>(light)) {
+        auto l = cast<AreaLight>(light);
+        auto pl = transform_point_inverse(light->frame, p);
+        auto sphere = (is<Sphere>(l->shape)) ? cast<Sphere>(l->shape) : nullptr;
+        if(sphere and lengthSqr(pl - sphere->center) > sphere->radius * sphere->radius) {
+            auto sin2_max = sphere->radius * sphere->radius / lengthSqr(pl - sphere->center);
+            return 1 / (2 * pif * sin2_max / (1 + sqrt(max(0.0f, 1 - sin2_max))));
+        }
+        auto cos_l = -dot(wi, n);
+        if(l->doublesided) cos_l = abs(cos_l);
+        if(cos_l <= 0) return 0;
+        return dist * dist / (cos_l * arealight_area(l));
+    }
+    else if(is<EnvLight>(light)) return envlight_sample_direction_pdf(cast<EnvLight>(light), transform_direction_inverse(light->frame, wi));
+    else return 0;
+}
 
-/// sample light background if needed (only userful for envlights)
+/// sample light background if needed (only userful for envlights); wo points from the scene to the environment
 inline vec3f light_sample_background(Light* light, const vec3f& wo) {
-    auto wol = transform_direction_inverse(light->frame, wo);
-    if(is<EnvLight>(light)) {
-        auto sample = cast<EnvLight>(light)->intensity;
-        return sample;
-    } else return zero3f;
+    if(is<EnvLight>(light)) return envlight_radiance(cast<EnvLight>(light), transform_direction_inverse(light->frame, wo));
+    else return zero3f;
 }
 
 /// init light sampling
 inline void sample_light_init(Light* light) {
     if(is<EnvLight>(light)) {
-        if(not cast<EnvLight>(light)->importance_sampling or not cast<EnvLight>(light)->envmap) return;
-        if(cast<EnvLight>(light)->_importance_distribution) delete cast<EnvLight>(light)->_importance_distribution;
-        const image<vec3f>& txt = cast<EnvLight>(light)->envmap->image;
-        image<float> values(txt.width(),txt.height());
+        auto env = cast<EnvLight>(light);
+        if(env->irradiance_sh) env->_irradiance_sh = envlight_irradiance_sh_init(env);
+        else env->_irradiance_sh.clear();
+        if(env->_importance_distribution) { delete env->_importance_distribution; env->_importance_distribution = nullptr; }
+        if(not env->importance_sampling or not env->envmap or env->envmap->_levels.empty()) return;
+        auto txt = texture_image(env->envmap);
+        vector<vector<float>> values(txt.height(), vector<float>(txt.width()));
         for (auto v : range(txt.height())) {
-            float sinTheta = sin(pif * float(v+.5f)/float(txt.height()));
-            for (auto u : range(txt.width())) values.at(u,v) = mean_component(txt.at(u,v)) * sinTheta;
+            float theta = pif * float(v+.5f)/float(txt.height());
+            // rows below the horizon never light hemisphere envlights
+            float sinTheta = (env->hemisphere and theta >= pif/2) ? 0 : sin(theta);
+            for (auto u : range(txt.width())) values[v][u] = mean_component(txt.at(u,v)) * sinTheta;
         }
-        vector<vector<float>> _values(values.height());
-        for (auto v : range(values.height())) {
-            _values[v].resize(values.width());
-            for (auto u : range(values.width())) _values[v][u] = values.at(u,v);
-        }
-        cast<EnvLight>(light)->_importance_distribution = new Distribution2D();
-        *cast<EnvLight>(light)->_importance_distribution = sample_init_distribution2d(_values);
-    } else {}
+        env->_importance_distribution = new Distribution2D();
+        *env->_importance_distribution = sample_init_distribution2d(values);
+        // black envmaps fall back to uniform sampling
+        if(not (env->_importance_distribution->marginal.integral > 0)) { delete env->_importance_distribution; env->_importance_distribution = nullptr; }
+    } else if(is<AreaLight>(light)) {
+        auto area = cast<AreaLight>(light);
+        shape_sample_init(area->shape);
+        area->_bounds = arealight_bounds(area);
+    }
+    else {}
+}
+
+/// whether a light has a position, and can then be selected stochastically
+inline bool light_is_local(Light* light) { return is<PointLight>(light) or is<AreaLight>(light); }
+
+/// emitted power of a local light
+inline float light_power(Light* light) {
+    if(is<PointLight>(light)) return 4 * pif * mean_component(cast<PointLight>(light)->intensity);
+    else if(is<AreaLight>(light)) {
+        auto area = cast<AreaLight>(light);
+        return pif * mean_component(area->intensity) * arealight_area(area) * ((area->doublesided) ? 2 : 1);
+    }
+    else return 0;
+}
+
+/// builds the power distribution and light bvh of the local lights
+void light_selection_init(LightGroup* lights);
+
+/// picks a local light proportionally to its power
+inline IndexSample light_select_power(LightGroup* lights, float u) {
+    IndexSample is;
+    if(lights->_local.empty()) return is;
+    auto ds = sample_distribution1d(&lights->_power_distribution, u);
+    is.idx = lights->_local[ds.index];
+    is.pdf = ds.pdf / lights->_local.size();
+    return is;
+}
+
+/// picks a local light traversing the light bvh by the estimated contribution at p with normal n
+IndexSample light_select_bvh(LightGroup* lights, const vec3f& p, const vec3f& n, float u);
+
+/// picks a local light with the given strategy ("power" or "bvh")
+inline IndexSample light_select(LightGroup* lights, const string& strategy, const vec3f& p, const vec3f& n, float u) {
+    if(strategy == "bvh") return light_select_bvh(lights, p, n, u);
+    else return light_select_power(lights, u);
 }
 
 /// init light sampling
-inline void sample_lights_init(LightGroup* lights) { for(auto light : lights->lights) sample_light_init(light); }
+inline void sample_lights_init(LightGroup* lights) {
+    for(auto light : lights->lights) sample_light_init(light);
+    light_selection_init(lights);
+}
 
 ///@}
 
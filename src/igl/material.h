@@ -15,6 +15,8 @@ struct Material : Node {
     REGISTER_FAST_RTTI(Node,Material,8)
     
     Texture*     normal_texture = nullptr; ///< normal map
+    
+    int          _tableid = -1; ///< index in the compiled material table (-1 if not compiled)
 };
 
 /// Lambert Material
@@ -36,10 +38,8 @@ struct Phong : Material {
     float        blur_size = 0.0f; ///< blurriness of reflection
     bool         texture_mapping = true; ///< whether we are going to use texture mapping
     bool         trilinear = false; ///< whether we are going to use trilinear filtering techniques
+    float        texcoord_scale = 1; ///< texture coordinate tiling
     Texture*     diffuse_texture = nullptr; ///< diffuse texture
-    Texture*     diffuse_texture_tri_1 = nullptr;
-    Texture*     diffuse_texture_tri_2 = nullptr;
-    Texture*     diffuse_texture_tri_3 = nullptr;
     Texture*     specular_texture = nullptr; ///< specular texture
     Texture*     exponent_texture = nullptr; ///< specular exponent texture
     Texture*     reflection_texture = nullptr; ///< reflection texture
@@ -57,6 +57,35 @@ struct LambertEmission : Material {
     Texture*    diffuse_texture = nullptr; ///< emission texture
 };
 
+/// Material resolved at a shading point, with textures evaluated (value type)
+struct Brdf {
+    enum Type { lambert, phong, lambert_emission };
+    
+    Type        type = lambert; ///< material model
+    vec3f       diffuse = zero3f; ///< diffuse color
+    vec3f       specular = zero3f; ///< specular color (phong)
+    float       exponent = 1; ///< specular exponent (phong)
+    vec3f       reflection = zero3f; ///< reflection color (phong)
+    float       blur_size = 0; ///< blurriness of reflection (phong)
+    bool        use_reflected = false; ///< use reflected or bisector (phong)
+    vec3f       emission = zero3f; ///< emission color (lambert emission)
+};
+
+/// Materials compiled into flat parameter arrays, indexed by material table id
+/// (a snapshot: edited materials keep their old parameters until the table is compiled again)
+struct MaterialTable {
+    vector<Material*>       material; ///< source materials
+    vector<Brdf::Type>      type; ///< material model
+    vector<unsigned char>   textured; ///< whether the material needs texture lookups at shading time
+    vector<vec3f>           diffuse; ///< diffuse color
+    vector<vec3f>           specular; ///< specular color (phong)
+    vector<float>           exponent; ///< specular exponent (phong)
+    vector<vec3f>           reflection; ///< reflection color (phong)
+    vector<float>           blur_size; ///< blurriness of reflection (phong)
+    vector<unsigned char>   use_reflected; ///< use reflected or bisector (phong)
+    vector<vec3f>           emission; ///< emission color (lambert emission)
+};
+
 ///@name eval interface
 ///@{
 
@@ -68,7 +97,8 @@ inline bool material_has_textures(Material* material) {
     }
     else if(is<Phong>(material)) {
         auto phong = cast<Phong>(material);
-        return phong->diffuse_texture or phong->specular_texture or phong->exponent_texture or phong->reflection_texture;
+        return phong->diffuse_texture or
+               phong->specular_texture or phong->exponent_texture or phong->reflection_texture;
     }
     else if(is<LambertEmission>(material)) {
         auto emission = cast<LambertEmission>(material);
@@ -82,169 +112,137 @@ inline frame3f material_shading_frame(Material* material, const frame3f& frame,
     return frame;
 }
 
-/// resolve texture coordinates
-inline Material* material_shading_textures(Material* material, const vec2f& texcoord, float dist) {
+/// resolve texture coordinates into the brdf at a shading point, with width the filter footprint in texcoord units
+inline Brdf material_shading_textures(Material* material, const vec2f& texcoord, float width) {
     if(is<Lambert>(material)) {
         auto lambert = cast<Lambert>(material);
-        auto ret = new Lambert();
-        ret->diffuse = lambert->diffuse;
+        auto ret = Brdf();
+        ret.type = Brdf::lambert;
+        ret.diffuse = lambert->diffuse;
         return ret;
     }
     else if(is<Phong>(material)) {
         auto phong = cast<Phong>(material);
-        auto ret = new Phong();
-        ret->blur_size = phong->blur_size;
-        ret->use_reflected = phong->use_reflected;
-        ret->diffuse = phong->diffuse;
+        auto ret = Brdf();
+        ret.type = Brdf::phong;
+        ret.blur_size = phong->blur_size;
+        ret.use_reflected = phong->use_reflected;
+        ret.diffuse = phong->diffuse;
         // Flag to use texture mapping
-        if(phong->texture_mapping) {
+        if(phong->texture_mapping and phong->diffuse_texture != nullptr) {
+            auto tc = texcoord * phong->texcoord_scale;
             // Texture filtering (5 Points)
-            // This flag decides whether we consider using mipmaps/smaller textures (64 times as patterned as normal)
-            // This is done in order to show the difference between trilinear filtering/normal texture mapping more easily
-            if(phong->trilinear) {
-                // If we have mipmaps loaded, do trilinear filtering
-                if(phong->diffuse_texture_tri_1 != nullptr && phong->diffuse_texture_tri_2 != nullptr &&
-                        phong->diffuse_texture_tri_3 != nullptr) {
-                    auto u = texcoord.x * 64;
-                    auto v = texcoord.y * 64;
-                    u -= floor(u);
-                    v -= floor(v);
-                    bool only_use_one = false;
-                    Texture *tex_1, *tex_2;
-                    float color_1_ratio, color_2_ratio;
-
-                    // Perform trilinear blending based upon viewing distance
-                    if(dist >= 0.0 && dist <= 4.0) {
-                        tex_1 = phong->diffuse_texture;
-                        tex_2 = phong->diffuse_texture_tri_1;
-
-                        // Trilinear blending
-                        color_1_ratio = 1 - dist / 4.0;
-                        color_2_ratio = 1 - color_1_ratio;
-                    }
-                    else if(dist > 4.0 && dist <= 8.0) {
-                        tex_1 = phong->diffuse_texture_tri_1;
-                        tex_2 = phong->diffuse_texture_tri_2;
-
-                        // Trilinear blending
-                        color_1_ratio = 1 - (dist - 4.0) / 4.0;
-                        color_2_ratio = 1 - color_1_ratio;
-                    }
-                    else if(dist > 8.0 && dist <= 16.0) {
-                        tex_1 = phong->diffuse_texture_tri_2;
-                        tex_2 = phong->diffuse_texture_tri_3;
-
-                        // Trilinear blending
-                        color_1_ratio = 1 - (dist - 8.0) / 8.0;
-                        color_2_ratio = 1 - color_1_ratio;
-                    }
-                    else {
-                        tex_1 = phong->diffuse_texture_tri_3;
-                        only_use_one = true;
-                    }
-
-                    // Perform bilinear filtering
-                    image3f &img_1 = tex_1->image;
-                    float u_1 = u * img_1.width() - 0.5;
-                    float v_1 = v * img_1.height() - 0.5;
-                    float x_1 = floor(u_1);
-                    float y_1 = floor(v_1);
-                    if(x_1 < 0)
-                        x_1 = 0.0;
-                    if(y_1 < 0)
-                        y_1 = 0.0;
-                    if(x_1 > img_1.width() - 2)
-                        x_1 = img_1.width() - 2;
-                    if(y_1 > img_1.height() - 2)
-                        y_1 = img_1.height() - 2;
-                    float u_1_ratio = u_1 - x_1;
-                    float v_1_ratio = v_1 - y_1;
-                    float u_1_opposite = 1 - u_1_ratio;
-                    float v_1_opposite = 1 - v_1_ratio;
-
-                    auto color_1 = (img_1.at(x_1, y_1) * u_1_opposite + img_1.at(x_1 + 1, y_1) * u_1_ratio) *
-                            v_1_opposite + (img_1.at(x_1, y_1 + 1) * u_1_opposite + img_1.at(x_1 + 1, y_1 + 1) * u_1_ratio) * v_1_ratio;
-
-                    // If we're not too far away from the image, blend with another mipmap
-                    if(!only_use_one) {
-                        image3f &img_2 = tex_2->image;
-                        float u_2 = u * img_2.width() - 0.5;
-                        float v_2 = v * img_2.height() - 0.5;
-                        float x_2 = floor(u_2);
-                        float y_2 = floor(v_2);
-                        if(x_2 < 0)
-                            x_2 = 0.0;
-                        if(y_2 < 0)
-                            y_2 = 0.0;
-                        if(x_2 > img_2.width() - 2)
-                            x_2 = img_2.width() - 2;
-                        if(y_2 > img_2.height() - 2)
-                            y_2 = img_2.height() - 2;
-                        float u_2_ratio = u_2 - x_2;
-                        float v_2_ratio = v_2 - y_2;
-                        float u_2_opposite = 1 - u_2_ratio;
-                        float v_2_opposite = 1 - v_2_ratio;
-
-                        auto color_2 = (img_2.at(x_2, y_2) * u_2_opposite + img_2.at(x_2 + 1, y_2) * u_2_ratio) *
-                                v_2_opposite + (img_2.at(x_2, y_2 + 1) * u_2_opposite + img_2.at(x_2 + 1, y_2 + 1) * u_2_ratio) * v_2_ratio;
-
-                        ret->diffuse += color_1 * color_1_ratio + color_2 * color_2_ratio;
-                    }
-                    else
-                        ret->diffuse += color_1;
-                }
-                // If we don't have mipmaps loaded, perform a heavily patterned normal texture map
-                else if(phong->diffuse_texture != nullptr) {
-                    auto x = texcoord.x * 64;
-                    x -= floor(x);
-                    auto y = texcoord.y * 64;
-                    y -= floor(y);
-
-                    ret->diffuse += phong->diffuse_texture->image.at(x * phong->diffuse_texture->image.width(),
-                                      y * phong->diffuse_texture->image.height());
-                }
-            }
+            // Blend the two mip levels closest to the ray footprint
+            if(phong->trilinear) ret.diffuse += texture_lookup_trilinear(phong->diffuse_texture, tc, width * phong->texcoord_scale);
             // Texture mapping (5 points)
             // Perform simple texture mapping
-            else {
-                if(phong->diffuse_texture != nullptr) {
-                    ret->diffuse += phong->diffuse_texture->image.at(texcoord.x * phong->diffuse_texture->image.width(),
-                                      texcoord.y * phong->diffuse_texture->image.height());
-                }
-            }
+            else ret.diffuse += texture_lookup_nearest(phong->diffuse_texture, tc);
         }
-        ret->specular = phong->specular;
-        ret->exponent = phong->exponent;
-        ret->reflection = phong->reflection;
+        ret.specular = phong->specular;
+        ret.exponent = phong->exponent;
+        ret.reflection = phong->reflection;
         return ret;
     }
     else if(is<LambertEmission>(material)) {
         auto emission = cast<LambertEmission>(material);
-        auto ret = new LambertEmission();
-        ret->diffuse = emission->diffuse;
-        ret->emission = emission->emission;
+        auto ret = Brdf();
+        ret.type = Brdf::lambert_emission;
+        ret.diffuse = emission->diffuse;
+        ret.emission = emission->emission;
         return ret;
     }
-    else { NOT_IMPLEMENTED_ERROR(); return nullptr; }
+    else { NOT_IMPLEMENTED_ERROR(); return Brdf(); }
 }
 
+///@}
+
+///@name material table interface
+///@{
+
+/// add a material to the table (once) and return its table id
+inline int material_table_add(MaterialTable* table, Material* material) {
+    if(material->_tableid >= 0 and material->_tableid < table->material.size() and
+       table->material[material->_tableid] == material) return material->_tableid;
+    auto ret = Brdf();
+    if(is<Lambert>(material)) {
+        ret.type = Brdf::lambert;
+        ret.diffuse = cast<Lambert>(material)->diffuse;
+    }
+    else if(is<Phong>(material)) {
+        auto phong = cast<Phong>(material);
+        ret.type = Brdf::phong;
+        ret.diffuse = phong->diffuse;
+        ret.specular = phong->specular;
+        ret.exponent = phong->exponent;
+        ret.reflection = phong->reflection;
+        ret.blur_size = phong->blur_size;
+        ret.use_reflected = phong->use_reflected;
+    }
+    else if(is<LambertEmission>(material)) {
+        auto emission = cast<LambertEmission>(material);
+        ret.type = Brdf::lambert_emission;
+        ret.diffuse = emission->diffuse;
+        ret.emission = emission->emission;
+    }
+    else NOT_IMPLEMENTED_ERROR();
+    material->_tableid = table->material.size();
+    table->material.push_back(material);
+    table->type.push_back(ret.type);
+    table->textured.push_back(material_has_textures(material));
+    table->diffuse.push_back(ret.diffuse);
+    table->specular.push_back(ret.specular);
+    table->exponent.push_back(ret.exponent);
+    table->reflection.push_back(ret.reflection);
+    table->blur_size.push_back(ret.blur_size);
+    table->use_reflected.push_back(ret.use_reflected);
+    table->emission.push_back(ret.emission);
+    return material->_tableid;
+}
+
+/// brdf of an untextured table material
+inline Brdf material_table_brdf(const MaterialTable* table, int tableid) {
+    auto ret = Brdf();
+    ret.type = table->type[tableid];
+    ret.diffuse = table->diffuse[tableid];
+    switch(ret.type) {
+        case Brdf::lambert: break;
+        case Brdf::phong:
+            ret.specular = table->specular[tableid];
+            ret.exponent = table->exponent[tableid];
+            ret.reflection = table->reflection[tableid];
+            ret.blur_size = table->blur_size[tableid];
+            ret.use_reflected = table->use_reflected[tableid];
+            break;
+        case Brdf::lambert_emission:
+            ret.emission = table->emission[tableid];
+            break;
+    }
+    return ret;
+}
+
+/// resolve the brdf at a shading point, from the table unless the material is textured or not compiled
+inline Brdf material_shading_textures(const MaterialTable* table, Material* material, const vec2f& texcoord, float width) {
+    auto tableid = material->_tableid;
+    if(table and tableid >= 0 and tableid < table->material.size() and
+       table->material[tableid] == material and not table->textured[tableid]) return material_table_brdf(table, tableid);
+    return material_shading_textures(material, texcoord, width);
+}
+
+///@}
+
+///@name brdf interface
+///@{
+
 /// evaluate the material color
-inline vec3f material_diffuse_albedo(Material* material) {
-    ERROR_IF_NOT(not material_has_textures(material), "cannot support textures");
-    if(is<Lambert>(material)) return cast<Lambert>(material)->diffuse;
-    else if(is<Phong>(material)) return cast<Phong>(material)->diffuse;
-    else if(is<LambertEmission>(material)) return cast<LambertEmission>(material)->diffuse;
-    else { NOT_IMPLEMENTED_ERROR(); return zero3f; }
+inline vec3f material_diffuse_albedo(const Brdf& brdf) {
+    return brdf.diffuse;
 }
 
 /// evaluete the emission of the material
-inline vec3f material_emission(Material* material, const frame3f& frame, const vec3f& wo) {
-    ERROR_IF_NOT(not material_has_textures(material), "cannot support textures");
-    if(is<LambertEmission>(material)) {
-        auto lambert = cast<LambertEmission>(material);
-        if(dot(wo,frame.z) <= 0) return zero3f;
-        return lambert->emission;
-    } else return zero3f;
+inline vec3f material_emission(const Brdf& brdf, const frame3f& frame, const vec3f& wo) {
+    if(brdf.type != Brdf::lambert_emission) return zero3f;
+    if(dot(wo,frame.z) <= 0) return zero3f;
+    return brdf.emission;
 }
 
 /// evaluate an approximation of the fresnel model
@@ -258,30 +256,18 @@ inline vec3f _schlickFresnel(const vec3f& rhos, const vec3f& w, const vec3f& wh)
 }
 
 /// evaluate product of BRDF and cosine
-inline vec3f material_brdfcos(Material* material, const frame3f& frame, const vec3f& wi, const vec3f& wo) {
-    ERROR_IF_NOT(not material_has_textures(material), "cannot support textures");
-    if(is<Lambert>(material)) {
-        auto lambert = cast<Lambert>(material);
-        if(dot(wi,frame.z) <= 0 or dot(wo,frame.z) <= 0) return zero3f;
-        return lambert->diffuse * abs(dot(wi,frame.z)) / pif;
-    }
-    else if(is<Phong>(material)) {
-        auto phong = cast<Phong>(material);
-        if(dot(wi,frame.z) <= 0 or dot(wo,frame.z) <= 0) return zero3f;
-        if(phong->use_reflected) {
+inline vec3f material_brdfcos(const Brdf& brdf, const frame3f& frame, const vec3f& wi, const vec3f& wo) {
+    if(dot(wi,frame.z) <= 0 or dot(wo,frame.z) <= 0) return zero3f;
+    if(brdf.type == Brdf::phong) {
+        if(brdf.use_reflected) {
             vec3f wr = reflect(-wi,frame.z);
-            return (phong->diffuse / pif + (phong->exponent + 8) * phong->specular*pow(max(dot(wo,wr),0.0f),phong->exponent) / (8*pif)) * abs(dot(wi,frame.z));
+            return (brdf.diffuse / pif + (brdf.exponent + 8) * brdf.specular*pow(max(dot(wo,wr),0.0f),brdf.exponent) / (8*pif)) * abs(dot(wi,frame.z));
         } else {
             vec3f wh = normalize(wi+wo);
-            return (phong->diffuse / pif + (phong->exponent + 8) * phong->specular*pow(max(dot(frame.z,wh),0.0f),phong->exponent) / (8*pif)) * abs(dot(wi,frame.z));
+            return (brdf.diffuse / pif + (brdf.exponent + 8) * brdf.specular*pow(max(dot(frame.z,wh),0.0f),brdf.exponent) / (8*pif)) * abs(dot(wi,frame.z));
         }
     }
-    else if(is<LambertEmission>(material)) {
-        auto lambert = cast<LambertEmission>(material);
-        if(dot(wi,frame.z) <= 0 or dot(wo,frame.z) <= 0) return zero3f;
-        return lambert->diffuse * abs(dot(wi,frame.z)) / pif;
-    }
-    else { NOT_IMPLEMENTED_ERROR(); return zero3f; }
+    else return brdf.diffuse * abs(dot(wi,frame.z)) / pif;
 }
 
 /// material average color for interactive drawing
@@ -302,78 +288,87 @@ struct BrdfSample {
 };
 
 /// evaluate color and direction of mirror reflection (zero if not reflections)
-inline BrdfSample material_sample_reflection(Material* material, const frame3f& frame, const vec3f& wo) {
-    ERROR_IF_NOT(not material_has_textures(material), "no textures allowed");
-    if(is<Phong>(material)) {
-        auto phong = cast<Phong>(material);
-        if(dot(wo,frame.z) <= 0) return BrdfSample();
-        auto bs = BrdfSample();
-        bs.brdfcos = phong->reflection;
-        bs.wi = reflect(-wo, frame.z);
-        bs.pdf = 1;
-        return bs;
+inline BrdfSample material_sample_reflection(const Brdf& brdf, const frame3f& frame, const vec3f& wo) {
+    if(brdf.type != Brdf::phong) return BrdfSample();
+    if(dot(wo,frame.z) <= 0) return BrdfSample();
+    auto bs = BrdfSample();
+    bs.brdfcos = brdf.reflection;
+    bs.wi = reflect(-wo, frame.z);
+    bs.pdf = 1;
+    return bs;
+}
+
+/// probability of picking the diffuse lobe over the specular one in material_sample_brdfcos
+inline float _material_diffuse_lobe_prob(const Brdf& brdf) {
+    auto wd = mean_component(brdf.diffuse);
+    auto ws = (brdf.type == Brdf::phong) ? mean_component(brdf.specular) : 0.0f;
+    return (wd + ws > 0) ? wd / (wd + ws) : 1;
+}
+
+/// direction d given in a frame with z along axis
+inline vec3f _material_lobe_direction(const vec3f& axis, const vec3f& d) {
+    auto bx = normalize(cross((abs(axis.z) < 0.9f) ? z3f : x3f, axis));
+    auto by = cross(axis, bx);
+    return bx * d.x + by * d.y + axis * d.z;
+}
+
+/// pdf of material_sample_brdfcos picking wi
+inline float material_sample_brdfcos_pdf(const Brdf& brdf, const frame3f& frame, const vec3f& wi, const vec3f& wo) {
+    if(dot(wi,frame.z) <= 0 or dot(wo,frame.z) <= 0) return 0;
+    auto pd = _material_diffuse_lobe_prob(brdf);
+    auto pdf = pd * dot(wi,frame.z) / pif;
+    if(pd < 1) {
+        if(brdf.use_reflected) pdf += (1-pd) * sample_direction_hemisphericalcospower_pdf(vec3f(0,0,dot(wi,reflect(-wo,frame.z))), brdf.exponent);
+        else {
+            auto wh = normalize(wi+wo);
+            pdf += (1-pd) * sample_direction_hemisphericalcospower_pdf(vec3f(0,0,dot(wh,frame.z)), brdf.exponent) / (4*dot(wo,wh));
+        }
     }
-    else { return BrdfSample(); }
+    return pdf;
 }
 
-/// evaluate color and direction of blurred mirror reflection (zero if not reflections)
-inline BrdfSample material_sample_blurryreflection(Material* material, const frame3f& frame, const vec3f& wo, const vec2f& suv) {
-    ERROR_IF_NOT(not material_has_textures(material), "no textures allowed");
+/// sample a direction from the diffuse and specular lobes (mirror reflection excluded), with ulobe picking the lobe
+inline BrdfSample material_sample_brdfcos(const Brdf& brdf, const frame3f& frame, const vec3f& wo, float ulobe, const vec2f& sample) {
+    if(dot(wo,frame.z) <= 0) return BrdfSample();
     auto bs = BrdfSample();
-    if(is<Phong>(material)) {
-        auto phong = cast<Phong>(material);
-        if(dot(wo,frame.z) <= 0) return BrdfSample();
-        auto wi = reflect(-wo, frame.z);
-        auto u = normalize(cross(wi, wo));
-        auto v = normalize(cross(wi, u));
-        auto sl = phong->blur_size;
-        
-        bs.brdfcos = phong->reflection;
-        bs.wi = normalize(wi + (0.5f-suv.x)*sl*u + (0.5f-suv.y)*sl*v);
-        bs.pdf = 1.0/(sl*sl);
-        
-        return bs;
+    if(ulobe < _material_diffuse_lobe_prob(brdf)) bs.wi = transform_direction(frame, sample_direction_hemisphericalcos(sample).dir);
+    else {
+        auto ds = sample_direction_hemisphericalcospower(sample, brdf.exponent);
+        if(brdf.use_reflected) bs.wi = _material_lobe_direction(reflect(-wo,frame.z), ds.dir);
+        else bs.wi = reflect(-wo, transform_direction(frame, ds.dir));
     }
-    else { return bs; }
+    bs.pdf = material_sample_brdfcos_pdf(brdf, frame, bs.wi, wo);
+    if(bs.pdf <= 0) return BrdfSample();
+    bs.brdfcos = material_brdfcos(brdf, frame, bs.wi, wo);
+    return bs;
+}
+
+/// evaluate color and direction of blurred mirror reflection (zero if not reflections)
+inline BrdfSample material_sample_blurryreflection(const Brdf& brdf, const frame3f& frame, const vec3f& wo, const vec2f& suv) {
+    if(brdf.type != Brdf::phong) return BrdfSample();
+    if(dot(wo,frame.z) <= 0) return BrdfSample();
+    auto wi = reflect(-wo, frame.z);
+    auto u = normalize(cross(wi, wo));
+    auto v = normalize(cross(wi, u));
+    auto sl = brdf.blur_size;
+    
+    auto bs = BrdfSample();
+    bs.brdfcos = brdf.reflection;
+    bs.wi = normalize(wi + (0.5f-suv.x)*sl*u + (0.5f-suv.y)*sl*v);
+    bs.pdf = 1.0/(sl*sl);
+    return bs;
 }
 
 /// pick a direction and sample it
-inline BrdfSample material_sample_brdfcos(Material* material, const frame3f& frame, const vec3f& wo, const vec2f& suv, float sl) {
-    ERROR_IF_NOT(not material_has_textures(material), "no textures allowed");
-    if(is<Lambert>(material)) {
-        auto lambert = cast<Lambert>(material);
-        if(dot(wo,frame.z) <= 0) return BrdfSample();
-        auto ds = sample_direction_hemisphericalcos(suv);
-        auto wi = transform_direction(frame, ds.dir);
-        BrdfSample bs;
-        bs.brdfcos = material_brdfcos(lambert, frame, wi, wo);
-        bs.wi = wi;
-        bs.pdf = ds.pdf;
-        return bs;
-    }
-    else if(is<Phong>(material)) {
-        auto phong = cast<Phong>(material);
-        if(dot(wo,frame.z) <= 0) return BrdfSample();
-        auto ds = sample_direction_hemisphericalcos(suv);
-        auto wi = transform_direction(frame, ds.dir);
-        BrdfSample bs;
-        bs.brdfcos = material_brdfcos(phong, frame, wi, wo);
-        bs.wi = wi;
-        bs.pdf = ds.pdf;
-        return bs;
-    }
-    else if(is<LambertEmission>(material)) {
-        auto lambert = cast<LambertEmission>(material);
-        if(dot(wo,frame.z) <= 0) return BrdfSample();
-        auto ds = sample_direction_hemisphericalcos(suv);
-        auto wi = transform_direction(frame, ds.dir);
-        BrdfSample bs;
-        bs.brdfcos = material_brdfcos(lambert, frame, wi, wo);
-        bs.wi = wi;
-        bs.pdf = ds.pdf;
-        return bs;
-    }
-    else { NOT_IMPLEMENTED_ERROR(); return BrdfSample(); }
+inline BrdfSample material_sample_brdfcos(const Brdf& brdf, const frame3f& frame, const vec3f& wo, const vec2f& suv, float sl) {
+    if(dot(wo,frame.z) <= 0) return BrdfSample();
+    auto ds = sample_direction_hemisphericalcos(suv);
+    auto wi = transform_direction(frame, ds.dir);
+    BrdfSample bs;
+    bs.brdfcos = material_brdfcos(brdf, frame, wi, wo);
+    bs.wi = wi;
+    bs.pdf = ds.pdf;
+    return bs;
 }
 
 ///@}
@@ -32,7 +32,9 @@ struct Node {
     Class() { _tid = _typeuid; }
 #endif
 #else
-#define REGISTER_FAST_RTTI(Super,Class,ID)
+#define REGISTER_FAST_RTTI(Super,Class,ID) \
+    static constexpr unsigned int _typeuid = Super::_typeuid * 256 + ID; \
+    virtual unsigned int _gettypeuid() override { return _typeuid; }
 #endif
 
 /// cast to a subtype
@@ -57,6 +59,15 @@ inline bool is(U* ptr) {
 #endif
 }
 
+/// concrete type of a node, to switch on the _typeuid of the leaf types (one load, one jump table)
+inline unsigned int node_typeuid(Node* node) {
+#if defined(_FAST_RTTI) and not defined(_FAST_RTTI_VIRTUAL)
+    return node->_tid;
+#else
+    return node->_gettypeuid();
+#endif
+}
+
 ///@}
 
 #endif
@@ -3,5 +3,802 @@
 #include "vmath/random.h"
 #include "intersect.h"
 
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+
 ///@file igl/pathtrace.cpp Pathtracing. @ingroup igl
 
+/// emissive surfaces that are also sampled as area lights, so that the two strategies are combined with MIS
+struct _PathtraceEmitters {
+    std::unordered_map<Primitive*,Light*>   prim_light; ///< area light sampling each emissive surface
+    std::unordered_set<Light*>              hittable; ///< lights that brdf sampling can reach
+};
+
+// matches area lights to the surfaces with the same shape and frame
+_PathtraceEmitters _pathtrace_emitters(Scene* scene, LightGroup* lights) {
+    auto emitters = _PathtraceEmitters();
+    auto shape_lights = std::unordered_map<Shape*,vector<Light*>>();
+    for(auto light : lights->lights) if(is<AreaLight>(light)) shape_lights[cast<AreaLight>(light)->shape].push_back(light);
+    if(shape_lights.empty()) return emitters;
+    for(auto prim : scene->prims->prims) {
+        if(not is<Surface>(prim) or not is<LambertEmission>(prim->material)) continue;
+        auto it = shape_lights.find(cast<Surface>(prim)->shape);
+        if(it == shape_lights.end()) continue;
+        for(auto light : it->second) {
+            auto& f = light->frame;
+            if(not (f.o == prim->frame.o and f.x == prim->frame.x and f.y == prim->frame.y and f.z == prim->frame.z)) continue;
+            emitters.prim_light[prim] = light;
+            emitters.hittable.insert(light);
+            break;
+        }
+    }
+    return emitters;
+}
+
+// light samples taken at a path vertex: up to shadow_samples for area and env lights at the first vertex, one otherwise
+inline int _pathtrace_light_nsamples(Light* light, int depth, const PathtraceOptions& opts) {
+    return (depth == 0) ? max(1, min(opts.shadow_samples, light_shadow_nsamples(light))) : 1;
+}
+
+// power heuristic weight of a strategy with pdf a against one with pdf b
+inline float _pathtrace_mis(float a, float b) { return a * a / (a * a + b * b); }
+
+/// state of a path between two vertices
+struct _PathState {
+    ray3f       ray; ///< extension ray
+    RayCone     cone; ///< footprint of the extension ray
+    vec3f       weight = one3f; ///< path throughput
+    float       bounce_pdf = 0; ///< pdf of the brdf sample that generated the ray (0 for camera rays and mirror reflections, never light sampled)
+    int         bounce_depth = 0; ///< depth of the origin of the ray
+    int         depth = 0; ///< depth of the next vertex
+    bool        diffuse = false; ///< whether the path bounced off the brdf lobes (then emitters reached through mirrors are caustics)
+};
+
+/// next event estimation sample, contributing its radiance if the shadow ray is not occluded
+struct _PathShadowRay {
+    ray3f       ray; ///< shadow ray
+    Light*      light = nullptr; ///< sampled light
+    vec3f       radiance = zero3f; ///< weighted contribution to the pixel
+};
+
+// shades the vertex found by the extension ray of path (or its escape if not hit): adds emission and ambient to c,
+// appends the light samples to shadows (adding them to c directly without shadows), and advances the path;
+// returns whether the path continues. With photon maps, caustics come from the caustic map instead of the paths
+// reaching the lights through mirrors, and with final gather the vertices after a brdf bounce end the path
+// with the global map estimate.
+bool _pathtrace_shade(Scene* scene, bool hit, const intersection3f& intersection, _PathState& path, const _PathtraceEmitters& emitters,
+                      PathtraceOptions& opts, Rng& rng, vec3f& c, vector<_PathShadowRay>& shadows) {
+    auto& ll = (opts.cameralights) ? scene->_cameralights : scene->lights;
+    auto& ray = path.ray;
+    auto& weight = path.weight;
+    if(not hit) {
+        c += weight * opts.background;
+        for(auto l : ll->lights) {
+            auto le = light_sample_background(l, ray.d);
+            if(le == zero3f) continue;
+            auto w = (path.bounce_pdf > 0) ? _pathtrace_mis(path.bounce_pdf, _pathtrace_light_nsamples(l, path.bounce_depth, opts) * light_shadow_sample_pdf(l, ray.e, ray.d, ray3f::rayinf, zero3f)) : 1;
+            c += weight * le * w;
+        }
+        return false;
+    }
+
+    // set up variables
+    auto frame = intersection.frame;
+    auto wo = -ray.d;
+    auto material = intersection.material;
+
+    // shading frame
+    if(opts.doublesided) frame = faceforward(frame,ray.d);
+    frame = material_shading_frame(material, frame, intersection.texcoord);
+
+    // brdf
+    path.cone = ray_cone_advance(path.cone, intersection.ray_t);
+    auto texcoord_width = path.cone.width * intersection.texcoord_density / max(abs(dot(wo, intersection.frame.z)), 0.01f);
+    auto brdf = material_shading_textures(scene->_materials, material, intersection.texcoord, texcoord_width);
+
+    // emission, weighted against light sampling for surfaces sampled as area lights
+    auto photons = (opts.photons > 0) ? opts._photons.get() : nullptr;
+    auto le = material_emission(brdf, frame, wo);
+    auto it = emitters.prim_light.find(intersection.prim);
+    if(photons and path.diffuse and path.bounce_pdf == 0 and it != emitters.prim_light.end()) le = zero3f;
+    if(not (le == zero3f)) {
+        auto w = 1.0f;
+        if(path.bounce_pdf > 0 and it != emitters.prim_light.end())
+            w = _pathtrace_mis(path.bounce_pdf, _pathtrace_light_nsamples(it->second, path.bounce_depth, opts) * light_shadow_sample_pdf(it->second, ray.e, ray.d, intersection.ray_t, intersection.geom_norm));
+        c += weight * le * w;
+    }
+
+    // the ambient term stands for the indirect illumination that is not traced
+    if(not opts.indirect) c += weight * opts.ambient * material_diffuse_albedo(brdf);
+
+    // photon mapping: the global map estimate stands for all the light reflected by the brdf lobes of a gather vertex
+    auto gather = photons and opts.photons_final_gather and path.diffuse;
+    if(gather) c += weight * photonmap_radiance(photons->global, photons->emitted, frame, brdf, wo, opts.photons_lookup, opts.photons_radius);
+    else if(photons) c += weight * photonmap_radiance(photons->caustic, photons->emitted, frame, brdf, wo, opts.photons_lookup, opts.photons_radius);
+
+    // probability of continuing with a mirror reflection rather than with the brdf lobes
+    auto refl = (opts.reflections) ? material_sample_reflection(brdf, frame, wo) : BrdfSample();
+    auto wr = mean_component(refl.brdfcos);
+    auto wb = (opts.indirect and not gather) ? mean_component(brdf.diffuse) + ((brdf.type == Brdf::phong) ? mean_component(brdf.specular) : 0.0f) : 0.0f;
+    auto pr = (wr + wb > 0) ? wr / (wr + wb) : 0.0f;
+
+    // next event estimation: one sample of each light (up to shadow_samples for area and env lights at the first
+    // vertex), weighted against brdf sampling when it can reach the light; gather vertices have their direct lighting
+    // in the photon estimate
+    for(auto l : ll->lights) {
+        if(gather) break;
+        auto ns = _pathtrace_light_nsamples(l, path.depth, opts);
+        for(auto k = 0; k < ns; k ++) {
+            auto ss = light_shadow_sample(l, frame.o, rng.next_vec2f(), true);
+            if(ss.radiance == zero3f) continue;
+            auto cl = ss.radiance * material_brdfcos(brdf,frame,ss.dir,wo) / (ss.pdf * ns);
+            if(cl == zero3f) continue;
+            auto w = 1.0f;
+            if(wb > 0 and ss.pdf_solidangle > 0 and (is<EnvLight>(l) or emitters.hittable.count(l)))
+                w = _pathtrace_mis(ns * ss.pdf_solidangle, (1-pr) * material_sample_brdfcos_pdf(brdf,frame,ss.dir,wo));
+            if(not opts.shadows) { c += weight * cl * w; continue; }
+            auto sr = _PathShadowRay();
+            sr.ray = ray3f::segment(frame.o,frame.o+ss.dir*ss.dist);
+            sr.light = l;
+            sr.radiance = weight * cl * w;
+            shadows.push_back(sr);
+        }
+    }
+
+    // Russian roulette after max_depth, so that paths have no fixed length
+    if(wr + wb <= 0) return false;
+    if(path.depth >= opts.max_depth) {
+        auto q = min(0.95f, max_component(weight));
+        if(rng.next_float() >= q) return false;
+        weight /= q;
+    }
+
+    // continue the path
+    if(rng.next_float() < pr) {
+        weight *= refl.brdfcos / pr;
+        path.bounce_pdf = 0;
+        ray = ray3f(frame.o,refl.wi);
+    } else {
+        auto bs = material_sample_brdfcos(brdf, frame, wo, rng.next_float(), rng.next_vec2f());
+        if(bs.brdfcos == zero3f) return false;
+        path.bounce_pdf = (1-pr) * bs.pdf;
+        path.bounce_depth = path.depth;
+        path.diffuse = true;
+        weight *= bs.brdfcos / path.bounce_pdf;
+        ray = ray3f(frame.o,bs.wi);
+    }
+    path.depth ++;
+    return true;
+}
+
+// traces a path vertex by vertex, testing the shadow rays of each vertex as they are generated
+vec3f _pathtrace_ray(Scene* scene, const ray3f& ray, const RayCone& cone, const _PathtraceEmitters& emitters, PathtraceOptions& opts, Rng& rng, vector<_PathShadowRay>& shadows) {
+    auto c = zero3f;
+    auto path = _PathState();
+    path.ray = ray;
+    path.cone = cone;
+    while(true) {
+        intersection3f intersection;
+        auto hit = intersect_scene_first(scene,path.ray,intersection);
+        shadows.clear();
+        auto more = _pathtrace_shade(scene, hit, intersection, path, emitters, opts, rng, c, shadows);
+        for(auto& sr : shadows) if(not intersect_scene_occluded(scene,sr.ray,sr.light)) c += sr.radiance;
+        if(not more) break;
+    }
+    return c;
+}
+
+// runs func(start,end,chunk) over the chunks of count items, interleaving the chunks over the threads
+template<typename Func>
+void _pathtrace_parallel(int count, int chunk_size, int nthreads, const Func& func) {
+    auto nchunks = (count + chunk_size - 1) / chunk_size;
+    auto run = [&](int start, int step) {
+        for(auto chunk = start; chunk < nchunks; chunk += step) func(chunk*chunk_size, min(count,(chunk+1)*chunk_size), chunk);
+        intersect_shadow_stats_flush();
+        texture_cache_stats_flush();
+    };
+    nthreads = min(nthreads, nchunks);
+    if(nthreads <= 1) { run(0, 1); return; }
+    auto threads = vector<std::thread>();
+    for(auto t = 0; t < nthreads; t ++) threads.push_back(std::thread(run, t, nthreads));
+    for(auto& thread : threads) thread.join();
+}
+
+/// paths in flight of the wavefront integrator, in structure of arrays layout
+struct _PathQueue {
+    vector<vec3f>       ray_e; ///< extension ray origins
+    vector<vec3f>       ray_d; ///< extension ray directions
+    vector<RayCone>     cone; ///< extension ray footprints
+    vector<vec3f>       weight; ///< path throughputs
+    vector<float>       bounce_pdf; ///< pdfs of the brdf samples that generated the rays
+    vector<int>         bounce_depth; ///< depths of the origins of the rays
+    vector<int>         depth; ///< depths of the next vertices
+    vector<char>        diffuse; ///< whether the paths bounced off the brdf lobes
+    vector<int>         pixel; ///< pixel of each path
+    
+    int size() const { return pixel.size(); }
+    
+    void resize(int n) {
+        ray_e.resize(n); ray_d.resize(n); cone.resize(n); weight.resize(n);
+        bounce_pdf.resize(n); bounce_depth.resize(n); depth.resize(n); diffuse.resize(n); pixel.resize(n);
+    }
+    
+    void set(int i, const _PathState& path, int p) {
+        ray_e[i] = path.ray.e; ray_d[i] = path.ray.d; cone[i] = path.cone; weight[i] = path.weight;
+        bounce_pdf[i] = path.bounce_pdf; bounce_depth[i] = path.bounce_depth; depth[i] = path.depth; diffuse[i] = path.diffuse; pixel[i] = p;
+    }
+    
+    _PathState get(int i) const {
+        auto path = _PathState();
+        path.ray = ray3f(ray_e[i], ray_d[i]); path.cone = cone[i]; path.weight = weight[i];
+        path.bounce_pdf = bounce_pdf[i]; path.bounce_depth = bounce_depth[i]; path.depth = depth[i]; path.diffuse = diffuse[i];
+        return path;
+    }
+};
+
+/// shadow rays in flight of the wavefront integrator, in structure of arrays layout
+struct _ShadowQueue {
+    vector<vec3f>       ray_e; ///< shadow ray origins
+    vector<vec3f>       ray_d; ///< shadow ray directions
+    vector<float>       ray_tmax; ///< shadow ray lengths
+    vector<Light*>      light; ///< sampled lights
+    vector<vec3f>       radiance; ///< contributions if not occluded
+    vector<int>         pixel; ///< pixel of each ray
+    vector<char>        occluded; ///< results of the shadow ray intersection
+    
+    int size() const { return pixel.size(); }
+    
+    void clear() { ray_e.clear(); ray_d.clear(); ray_tmax.clear(); light.clear(); radiance.clear(); pixel.clear(); occluded.clear(); }
+    
+    void push_back(const _PathShadowRay& sr, int p) {
+        ray_e.push_back(sr.ray.e); ray_d.push_back(sr.ray.d); ray_tmax.push_back(sr.ray.tmax);
+        light.push_back(sr.light); radiance.push_back(sr.radiance); pixel.push_back(p);
+    }
+};
+
+// paths shaded per chunk of the wavefront integrator, each chunk with its own generator
+const int _pathtrace_wavefront_chunk = 1024;
+
+// wavefront integrator: all the paths of a pass advance one vertex at a time through separate stages
+// (extension ray intersection, shading, shadow ray intersection, accumulation), so that each stage runs
+// over arrays of work with no divergence between the paths
+void _pathtrace_wavefront(ImageBuffer& buffer, Scene* scene, const RayCone& cone, const _PathtraceEmitters& emitters, PathtraceOptions& opts, int nthreads) {
+    auto w = buffer.width();
+    auto h = buffer.height();
+    auto npixels = w*h;
+    auto radiance = vector<vec3f>(npixels, zero3f);
+
+    // camera ray generation, with the same stratification as the megakernel
+    auto paths = _PathQueue();
+    paths.resize(npixels);
+    int s2 = max(1,(int)sqrt(opts.samples));
+    _pathtrace_parallel(h, 1, nthreads, [&](int j, int, int) {
+        auto& rng = opts._rngs[j];
+        for(int i = 0; i < w; i ++) {
+            auto cs = buffer.samples.at(i,h-1-j);
+            auto ii = cs % s2; auto jj = (cs / s2) % s2;
+            float u = (i+(ii+rng.next_float())/s2)/w;
+            float v = (j+(jj+rng.next_float())/s2)/h;
+            auto path = _PathState();
+            path.ray = camera_ray(scene->camera,vec2f(u,v));
+            path.cone = cone;
+            paths.set(j*w+i, path, j*w+i);
+        }
+    });
+
+    auto intersections = vector<intersection3f>();
+    auto hits = vector<char>();
+    auto chunk_paths = vector<_PathQueue>();
+    auto chunk_shadows = vector<_ShadowQueue>();
+    while(paths.size()) {
+        auto n = paths.size();
+        auto nchunks = (n + _pathtrace_wavefront_chunk - 1) / _pathtrace_wavefront_chunk;
+
+        // extension rays
+        intersections.resize(n);
+        hits.resize(n);
+        _pathtrace_parallel(n, _pathtrace_wavefront_chunk, nthreads, [&](int start, int end, int) {
+            intersect_scene_first_batch(scene, end-start, &paths.ray_e[start], &paths.ray_d[start], &intersections[start], &hits[start]);
+        });
+
+        // shading, writing the surviving paths and the shadow rays of each chunk to its own queues;
+        // each path owns its pixel so the direct contributions need no synchronization
+        chunk_paths.resize(nchunks);
+        chunk_shadows.resize(nchunks);
+        _pathtrace_parallel(n, _pathtrace_wavefront_chunk, nthreads, [&](int start, int end, int chunk) {
+            auto& rng = opts._rngs[chunk];
+            auto& next = chunk_paths[chunk];
+            auto& queue = chunk_shadows[chunk];
+            next.resize(end-start);
+            queue.clear();
+            auto survivors = 0;
+            auto vertex_shadows = vector<_PathShadowRay>();
+            for(auto i = start; i < end; i ++) {
+                auto path = paths.get(i);
+                auto c = zero3f;
+                vertex_shadows.clear();
+                auto more = _pathtrace_shade(scene, hits[i], intersections[i], path, emitters, opts, rng, c, vertex_shadows);
+                radiance[paths.pixel[i]] += c;
+                for(auto& sr : vertex_shadows) queue.push_back(sr, paths.pixel[i]);
+                if(more) next.set(survivors++, path, paths.pixel[i]);
+            }
+            next.resize(survivors);
+        });
+
+        // compaction of the surviving paths, in chunk order
+        auto survivors = 0;
+        for(auto& next : chunk_paths) survivors += next.size();
+        auto compacted = _PathQueue();
+        compacted.resize(survivors);
+        auto idx = 0;
+        for(auto& next : chunk_paths) {
+            for(auto i : range(next.size())) {
+                compacted.ray_e[idx] = next.ray_e[i]; compacted.ray_d[idx] = next.ray_d[i];
+                compacted.cone[idx] = next.cone[i]; compacted.weight[idx] = next.weight[i];
+                compacted.bounce_pdf[idx] = next.bounce_pdf[i]; compacted.bounce_depth[idx] = next.bounce_depth[i];
+                compacted.depth[idx] = next.depth[i]; compacted.diffuse[idx] = next.diffuse[i]; compacted.pixel[idx] = next.pixel[i];
+                idx ++;
+            }
+        }
+        std::swap(paths, compacted);
+
+        // shadow rays, tested in the queues of the chunks that generated them (they outnumber the paths, so they are not copied)
+        _pathtrace_parallel(nchunks, 1, nthreads, [&](int chunk, int, int) {
+            auto& queue = chunk_shadows[chunk];
+            queue.occluded.resize(queue.size());
+            intersect_scene_occluded_batch(scene, queue.size(), queue.ray_e.data(), queue.ray_d.data(), queue.ray_tmax.data(), queue.light.data(), queue.occluded.data());
+        });
+
+        // accumulation of the unoccluded light samples
+        for(auto chunk : range(nchunks)) {
+            auto& queue = chunk_shadows[chunk];
+            for(auto i : range(queue.size())) if(not queue.occluded[i]) radiance[queue.pixel[i]] += queue.radiance[i];
+        }
+    }
+
+    for(int j = 0; j < h; j ++) {
+        for(int i = 0; i < w; i ++) {
+            buffer.accum.at(i,h-1-j) += radiance[j*w+i];
+            buffer.samples.at(i,h-1-j) += 1;
+        }
+    }
+}
+
+// subpaths are capped at this many vertices, which only cuts the rare paths surviving as many roulette steps
+const int _bdpt_max_vertices = 32;
+
+/// vertex of a camera or light subpath
+struct _BdptVertex {
+    enum Type { camera_vertex, light_vertex, surface_vertex };
+    
+    Type        type = surface_vertex; ///< vertex type
+    vec3f       pos = zero3f; ///< position
+    vec3f       norm = zero3f; ///< geometric normal (zero for the camera and point lights)
+    frame3f     frame = identity_frame3f; ///< shading frame (surfaces)
+    Brdf        brdf; ///< material at the vertex (surfaces)
+    vec3f       wo = zero3f; ///< direction towards the previous vertex of the subpath (surfaces)
+    vec3f       beta = one3f; ///< subpath throughput up to the vertex
+    float       pr = 0; ///< probability of continuing with the mirror reflection (surfaces)
+    Light*      light = nullptr; ///< light of light vertices, and area light of emissive surfaces sampled as lights
+    bool        from_light = false; ///< whether the vertex belongs to a light subpath (surfaces)
+    bool        delta = false; ///< whether the subpath continued from the vertex with a mirror reflection
+    float       pdf_fwd = 0; ///< area density of the vertex when generated by its subpath
+    float       pdf_rev = 0; ///< area density of the vertex when generated from the other end of the path
+};
+
+/// scene data shared by the bidirectional subpaths and connections
+struct _BdptContext {
+    Scene*                              scene = nullptr; ///< scene
+    LightGroup*                         lights = nullptr; ///< lights
+    _PathtraceEmitters                  emitters; ///< emissive surfaces sampled as area lights
+    std::unordered_map<Light*,float>    select_pdf; ///< probability of picking each local light to start a light subpath
+    float                               image_area = 1; ///< area of the image plane at unit distance from the camera
+    PathtraceOptions*                   opts = nullptr; ///< options
+};
+
+// area density at next of a solid angle density at v
+inline float _bdpt_convert(float pdf, const _BdptVertex& v, const _BdptVertex& next) {
+    auto d = next.pos - v.pos;
+    auto d2 = lengthSqr(d);
+    if(d2 <= 0) return 0;
+    if(not (next.norm == zero3f)) pdf *= abs(dot(next.norm, d)) / sqrt(d2);
+    return pdf / d2;
+}
+
+// radiance emitted by a local light from a point with normal n along w
+inline vec3f _bdpt_emitted(Light* light, const vec3f& n, const vec3f& w) {
+    if(is<PointLight>(light)) return cast<PointLight>(light)->intensity;
+    auto area = cast<AreaLight>(light);
+    return (area->doublesided or dot(n, w) > 0) ? area->intensity : zero3f;
+}
+
+// solid angle density of a local light emitting along w from a point with normal n (cosine distributed for area lights)
+inline float _bdpt_emission_pdf(Light* light, const vec3f& n, const vec3f& w) {
+    if(is<PointLight>(light)) return 1 / (4*pif);
+    auto c = dot(n, w);
+    if(cast<AreaLight>(light)->doublesided) return abs(c) / (2*pif);
+    return (c > 0) ? c / pif : 0;
+}
+
+// area density of picking a light and the point of v on it
+inline float _bdpt_origin_pdf(const _BdptContext& ctx, const _BdptVertex& v) {
+    auto it = ctx.select_pdf.find(v.light);
+    if(it == ctx.select_pdf.end()) return 0;
+    if(is<PointLight>(v.light)) return it->second;
+    return it->second / arealight_area(cast<AreaLight>(v.light));
+}
+
+// whether light subpaths starting at the light of v cannot be reached by the camera subpaths
+inline bool _bdpt_delta_light(const _BdptContext& ctx, const _BdptVertex& v) {
+    return is<PointLight>(v.light) or not ctx.emitters.hittable.count(v.light);
+}
+
+// image coordinates of the projection of p, false if outside the image
+inline bool _bdpt_camera_uv(Camera* camera, const vec3f& p, vec2f& uv) {
+    auto pl = transform_point_inverse(camera->frame, p);
+    if(pl.z >= 0) return false;
+    uv.x = pl.x * camera->image_dist / (-pl.z * camera->image_width) + 0.5f;
+    uv.y = pl.y * camera->image_dist / (-pl.z * camera->image_height) + 0.5f;
+    return uv.x >= 0 and uv.x < 1 and uv.y >= 0 and uv.y < 1;
+}
+
+// area density at next of sampling it from v, reached from prev (only used by surfaces)
+float _bdpt_pdf(const _BdptContext& ctx, const _BdptVertex* prev, const _BdptVertex& v, const _BdptVertex& next) {
+    auto wi = normalize(next.pos - v.pos);
+    auto pdf = 0.0f;
+    switch(v.type) {
+        case _BdptVertex::camera_vertex: {
+            // camera rays are uniform on the image plane
+            auto uv = zero2f;
+            if(not _bdpt_camera_uv(ctx.scene->camera, next.pos, uv)) return 0;
+            auto c = -dot(wi, ctx.scene->camera->frame.z);
+            pdf = 1 / (ctx.image_area * c * c * c);
+        } break;
+        case _BdptVertex::light_vertex: pdf = _bdpt_emission_pdf(v.light, v.norm, wi); break;
+        case _BdptVertex::surface_vertex: pdf = (1-v.pr) * material_sample_brdfcos_pdf(v.brdf, v.frame, wi, normalize(prev->pos - v.pos)); break;
+    }
+    return _bdpt_convert(pdf, v, next);
+}
+
+// brdf and cosine at v towards p; for light vertices, the emission cosine
+vec3f _bdpt_f(const _BdptVertex& v, const vec3f& p) {
+    auto wi = normalize(p - v.pos);
+    if(v.type == _BdptVertex::light_vertex) {
+        if(is<PointLight>(v.light)) return one3f;
+        return (_bdpt_emitted(v.light, v.norm, wi) == zero3f) ? zero3f : one3f * abs(dot(v.norm, wi));
+    }
+    auto f = material_brdfcos(v.brdf, v.frame, wi, v.wo);
+    // light subpaths carry importance, which is not symmetric with shading normals (Veach)
+    if(v.from_light) {
+        auto den = abs(dot(v.wo, v.norm)) * abs(dot(wi, v.frame.z));
+        f *= (den > 0) ? abs(dot(v.wo, v.frame.z)) * abs(dot(wi, v.norm)) / den : 0;
+    }
+    return f;
+}
+
+// samples a light vertex: a local light by power, then a point uniformly on it
+bool _bdpt_sample_light(const _BdptContext& ctx, Rng& rng, _BdptVertex& v) {
+    auto ls = light_select_power(ctx.lights, rng.next_float());
+    if(ls.idx < 0 or ls.pdf <= 0) return false;
+    v = _BdptVertex();
+    v.type = _BdptVertex::light_vertex;
+    v.light = ctx.lights->lights[ls.idx];
+    if(is<PointLight>(v.light)) {
+        v.pos = v.light->frame.o;
+        v.pdf_fwd = ls.pdf;
+        v.beta = cast<PointLight>(v.light)->intensity / v.pdf_fwd;
+    } else {
+        auto area = cast<AreaLight>(v.light);
+        auto sss = shape_sample_uniform(area->shape, rng.next_vec2f());
+        v.pos = transform_point(area->frame, sss.frame.o);
+        v.norm = normalize(transform_direction(area->frame, sss.frame.z));
+        v.pdf_fwd = ls.pdf / sss.area;
+        v.beta = area->intensity / v.pdf_fwd;
+    }
+    return true;
+}
+
+// extends a subpath from n vertices along ray, sampled with solid angle density pdf_dir from the last vertex;
+// returns the vertices of the subpath. Camera subpaths also add to c the contributions of the env and
+// directional lights, combining brdf and light sampling with MIS as in unidirectional pathtracing.
+int _bdpt_walk(const _BdptContext& ctx, ray3f ray, RayCone cone, vec3f beta, float pdf_dir, bool from_light, Rng& rng, _BdptVertex* path, int n, vec3f& c) {
+    auto scene = ctx.scene;
+    auto& opts = *ctx.opts;
+    // pdf of the brdf sample that generated the ray (0 for camera rays and mirror reflections), for env light MIS
+    auto bounce_pdf = 0.0f;
+    auto rr = one3f;
+    for(auto bounce = 0; n < _bdpt_max_vertices; bounce ++) {
+        intersection3f intersection;
+        if(not intersect_scene_first(scene,ray,intersection)) {
+            if(from_light) break;
+            c += beta * opts.background;
+            for(auto l : ctx.lights->lights) {
+                auto le = light_sample_background(l, ray.d);
+                if(le == zero3f) continue;
+                auto w = (bounce_pdf > 0) ? _pathtrace_mis(bounce_pdf, light_shadow_sample_pdf(l, ray.e, ray.d, ray3f::rayinf, zero3f)) : 1;
+                c += beta * le * w;
+            }
+            break;
+        }
+        
+        // vertex
+        auto& prev = path[n-1];
+        auto& v = path[n];
+        v = _BdptVertex();
+        v.pos = intersection.frame.o;
+        v.norm = normalize(intersection.geom_norm);
+        v.wo = -ray.d;
+        v.beta = beta;
+        v.from_light = from_light;
+        auto it = ctx.emitters.prim_light.find(intersection.prim);
+        if(it != ctx.emitters.prim_light.end()) v.light = it->second;
+        v.frame = intersection.frame;
+        if(opts.doublesided) v.frame = faceforward(v.frame,ray.d);
+        v.frame = material_shading_frame(intersection.material, v.frame, intersection.texcoord);
+        cone = ray_cone_advance(cone, intersection.ray_t);
+        auto texcoord_width = cone.width * intersection.texcoord_density / max(abs(dot(v.wo, intersection.frame.z)), 0.01f);
+        v.brdf = material_shading_textures(scene->_materials, intersection.material, intersection.texcoord, texcoord_width);
+        v.pdf_fwd = _bdpt_convert(pdf_dir, prev, v);
+        n ++;
+        
+        // probability of continuing with a mirror reflection rather than with the brdf lobes
+        auto refl = (opts.reflections) ? material_sample_reflection(v.brdf, v.frame, v.wo) : BrdfSample();
+        auto wr = mean_component(refl.brdfcos);
+        auto wb = mean_component(v.brdf.diffuse) + ((v.brdf.type == Brdf::phong) ? mean_component(v.brdf.specular) : 0.0f);
+        v.pr = (wr + wb > 0) ? wr / (wr + wb) : 0.0f;
+        
+        // the lights that are not local are only sampled from the camera vertices
+        if(not from_light) {
+            for(auto l : ctx.lights->lights) {
+                if(light_is_local(l)) continue;
+                auto ss = light_shadow_sample(l, v.pos, rng.next_vec2f(), true);
+                if(ss.radiance == zero3f) continue;
+                auto cl = ss.radiance * material_brdfcos(v.brdf,v.frame,ss.dir,v.wo) / ss.pdf;
+                if(cl == zero3f) continue;
+                if(opts.shadows and intersect_scene_occluded(scene,ray3f::segment(v.pos,v.pos+ss.dir*ss.dist),l)) continue;
+                auto w = 1.0f;
+                if(wb > 0 and ss.pdf_solidangle > 0 and is<EnvLight>(l))
+                    w = _pathtrace_mis(ss.pdf_solidangle, (1-v.pr) * material_sample_brdfcos_pdf(v.brdf,v.frame,ss.dir,v.wo));
+                c += beta * cl * w;
+            }
+        }
+        
+        // Russian roulette after max_depth
+        if(wr + wb <= 0) break;
+        if(bounce >= opts.max_depth) {
+            auto q = min(0.95f, max_component(rr));
+            if(rng.next_float() >= q) break;
+            beta /= q;
+            rr /= q;
+        }
+        
+        // continue the subpath, with zero densities through mirror reflections (they cancel in the MIS weights)
+        if(rng.next_float() < v.pr) {
+            auto w = refl.brdfcos / v.pr;
+            beta *= w;
+            rr *= w;
+            v.delta = true;
+            prev.pdf_rev = 0;
+            pdf_dir = 0;
+            bounce_pdf = 0;
+            ray = ray3f(v.pos,refl.wi);
+        } else {
+            auto bs = material_sample_brdfcos(v.brdf, v.frame, v.wo, rng.next_float(), rng.next_vec2f());
+            if(bs.brdfcos == zero3f) break;
+            pdf_dir = (1-v.pr) * bs.pdf;
+            auto w = _bdpt_f(v, v.pos + bs.wi) / pdf_dir;
+            beta *= w;
+            rr *= w;
+            prev.pdf_rev = _bdpt_convert((1-v.pr) * material_sample_brdfcos_pdf(v.brdf, v.frame, v.wo, bs.wi), v, prev);
+            bounce_pdf = pdf_dir;
+            ray = ray3f(v.pos,bs.wi);
+        }
+        if(beta == zero3f) break;
+    }
+    return n;
+}
+
+// light subpath from a local light picked by power
+int _bdpt_light_subpath(const _BdptContext& ctx, Rng& rng, _BdptVertex* path) {
+    auto& v = path[0];
+    if(not _bdpt_sample_light(ctx, rng, v)) return 0;
+    auto dir = zero3f;
+    auto pdf_dir = 0.0f;
+    if(is<PointLight>(v.light)) {
+        auto ds = sample_direction_spherical(rng.next_vec2f());
+        dir = ds.dir;
+        pdf_dir = 1 / (4*pif);
+    } else {
+        auto ds = sample_direction_hemisphericalcos(rng.next_vec2f());
+        auto n = v.norm;
+        if(cast<AreaLight>(v.light)->doublesided and rng.next_float() < 0.5f) n = -n;
+        dir = _material_lobe_direction(n, ds.dir);
+        pdf_dir = _bdpt_emission_pdf(v.light, v.norm, dir);
+    }
+    if(pdf_dir <= 0) return 1;
+    auto beta = v.beta * _bdpt_f(v, v.pos + dir) / pdf_dir;
+    auto c = zero3f;
+    return _bdpt_walk(ctx, ray3f(v.pos, dir), RayCone(), beta, pdf_dir, true, rng, path, 1, c);
+}
+
+// MIS weight of the path connecting the first s light and first t camera vertices, over all the strategies that
+// could generate it (power heuristic); sampled replaces the light vertex when s is 1 (Veach, pbrt)
+float _bdpt_mis(const _BdptContext& ctx, const _BdptVertex* light, int s, const _BdptVertex* camera, int t, const _BdptVertex& sampled) {
+    if(s + t == 2) return 1;
+    float light_fwd[_bdpt_max_vertices], light_rev[_bdpt_max_vertices], camera_fwd[_bdpt_max_vertices], camera_rev[_bdpt_max_vertices];
+    bool light_delta[_bdpt_max_vertices], camera_delta[_bdpt_max_vertices];
+    for(auto i : range(s)) { light_fwd[i] = light[i].pdf_fwd; light_rev[i] = light[i].pdf_rev; light_delta[i] = light[i].delta; }
+    for(auto i : range(t)) { camera_fwd[i] = camera[i].pdf_fwd; camera_rev[i] = camera[i].pdf_rev; camera_delta[i] = camera[i].delta; }
+    
+    // densities around the connection, which are not known to the subpaths; the endpoints are connected with their brdf lobes
+    auto& pt = camera[t-1];
+    auto& qs = (s == 1) ? sampled : light[max(s-1,0)];
+    if(s == 1) light_fwd[0] = sampled.pdf_fwd;
+    camera_delta[t-1] = false;
+    if(s > 0) light_delta[s-1] = false;
+    if(s > 0) camera_rev[t-1] = _bdpt_pdf(ctx, (s > 1) ? &light[s-2] : nullptr, qs, pt);
+    else camera_rev[t-1] = _bdpt_origin_pdf(ctx, pt);
+    if(t > 1) {
+        if(s > 0) camera_rev[t-2] = _bdpt_pdf(ctx, &qs, pt, camera[t-2]);
+        else camera_rev[t-2] = _bdpt_convert(_bdpt_emission_pdf(pt.light, pt.norm, normalize(camera[t-2].pos - pt.pos)), pt, camera[t-2]);
+    }
+    if(s > 0) light_rev[s-1] = _bdpt_pdf(ctx, (t > 1) ? &camera[t-2] : nullptr, pt, qs);
+    if(s > 1) light_rev[s-2] = _bdpt_pdf(ctx, &pt, qs, light[s-2]);
+    
+    // ratios of the densities of the other strategies to this one, walking away from the connection;
+    // zero densities come from mirror reflections and cancel out
+    auto remap = [](float pdf) { return (pdf != 0) ? pdf : 1.0f; };
+    auto sum = 0.0f;
+    auto r = 1.0f;
+    for(auto i = t-1; i > 0; i --) {
+        r *= remap(camera_rev[i]) / remap(camera_fwd[i]);
+        if(not camera_delta[i] and not camera_delta[i-1]) sum += r * r;
+    }
+    r = 1;
+    for(auto i = s-1; i >= 0; i --) {
+        r *= remap(light_rev[i]) / remap(light_fwd[i]);
+        auto delta_prev = (i > 0) ? light_delta[i-1] : _bdpt_delta_light(ctx, (s == 1) ? sampled : light[0]);
+        if(not light_delta[i] and not delta_prev) sum += r * r;
+    }
+    return 1 / (1 + sum);
+}
+
+// contribution of the path connecting the first s light and first t camera vertices; for t = 1 the path
+// reaches the camera through the image point uv, false if it does not
+vec3f _bdpt_connect(const _BdptContext& ctx, const _BdptVertex* light, int s, const _BdptVertex* camera, int t, Rng& rng, vec2f& uv) {
+    auto scene = ctx.scene;
+    auto& opts = *ctx.opts;
+    auto c = zero3f;
+    auto sampled = _BdptVertex();
+    if(s == 0) {
+        // the camera subpath hits an emitter
+        auto& pt = camera[t-1];
+        if(pt.type != _BdptVertex::surface_vertex) return zero3f;
+        if(not pt.light) return pt.beta * material_emission(pt.brdf, pt.frame, pt.wo);
+        c = pt.beta * _bdpt_emitted(pt.light, pt.norm, pt.wo);
+    } else if(t == 1) {
+        // the light subpath is seen by the camera
+        auto& qs = light[s-1];
+        if(not _bdpt_camera_uv(scene->camera, qs.pos, uv)) return zero3f;
+        auto cam = scene->camera->frame.o;
+        auto cos_c = -dot(normalize(qs.pos - cam), scene->camera->frame.z);
+        // importance of a pinhole camera, 1 / (A cos^4) with A the image plane area at unit distance, times cos / d^2
+        c = qs.beta * _bdpt_f(qs, cam) / (ctx.image_area * cos_c * cos_c * cos_c * distSqr(qs.pos, cam));
+        if(c == zero3f) return zero3f;
+        if(opts.shadows and intersect_scene_any(scene, ray3f::segment(qs.pos, cam))) return zero3f;
+    } else if(s == 1) {
+        // the camera subpath is connected to a new light sample
+        auto& pt = camera[t-1];
+        if(not _bdpt_sample_light(ctx, rng, sampled)) return zero3f;
+        c = pt.beta * _bdpt_f(pt, sampled.pos) * _bdpt_f(sampled, pt.pos) * sampled.beta / distSqr(pt.pos, sampled.pos);
+        if(c == zero3f) return zero3f;
+        if(opts.shadows and intersect_scene_occluded(scene, ray3f::segment(pt.pos, sampled.pos), sampled.light)) return zero3f;
+    } else {
+        // the two subpaths are connected by a segment
+        auto& qs = light[s-1];
+        auto& pt = camera[t-1];
+        c = qs.beta * _bdpt_f(qs, pt.pos) * _bdpt_f(pt, qs.pos) * pt.beta / distSqr(qs.pos, pt.pos);
+        if(c == zero3f) return zero3f;
+        if(opts.shadows and intersect_scene_any(scene, ray3f::segment(qs.pos, pt.pos))) return zero3f;
+    }
+    return c * _bdpt_mis(ctx, light, s, camera, t, sampled);
+}
+
+// bidirectional pathtracing: for each pixel sample, a camera and a light subpath are connected in every
+// possible way and the strategies combined with MIS; light tracing connections are splatted to the pixel
+// they reach, which keeps the estimate unbiased since every pass traces one light subpath per pixel
+void _pathtrace_bidirectional(ImageBuffer& buffer, Scene* scene, const RayCone& cone, PathtraceOptions& opts, int nthreads) {
+    ERROR_IF_NOT(not scene->camera->orthographic, "bidirectional pathtracing needs a perspective camera");
+    auto w = buffer.width();
+    auto h = buffer.height();
+    auto ctx = _BdptContext();
+    ctx.scene = scene;
+    ctx.lights = (opts.cameralights) ? scene->_cameralights : scene->lights;
+    ctx.emitters = _pathtrace_emitters(scene, ctx.lights);
+    for(auto k : range(ctx.lights->_local.size())) {
+        auto& dist = ctx.lights->_power_distribution;
+        auto pdf = (dist.integral > 0) ? dist.values[k] / dist.integral : 1;
+        ctx.select_pdf[ctx.lights->lights[ctx.lights->_local[k]]] = pdf / ctx.lights->_local.size();
+    }
+    auto camera = scene->camera;
+    ctx.image_area = camera->image_width * camera->image_height / (camera->image_dist * camera->image_dist);
+    ctx.opts = &opts;
+    
+    // light tracing contributions of each row, added in row order so that images do not depend on the threads
+    auto splats = vector<vector<std::pair<int,vec3f>>>(h);
+    int s2 = max(1,(int)sqrt(opts.samples));
+    _pathtrace_parallel(h, 1, nthreads, [&](int j, int, int) {
+        auto& rng = opts._rngs[j];
+        _BdptVertex light_path[_bdpt_max_vertices], camera_path[_bdpt_max_vertices];
+        for(int i = 0; i < w; i ++) {
+            auto cs = buffer.samples.at(i,h-1-j);
+            auto ii = cs % s2; auto jj = (cs / s2) % s2;
+            float u = (i+(ii+rng.next_float())/s2)/w;
+            float v = (j+(jj+rng.next_float())/s2)/h;
+            auto ray = camera_ray(camera,vec2f(u,v));
+            auto c = zero3f;
+            
+            auto nl = _bdpt_light_subpath(ctx, rng, light_path);
+            auto& z0 = camera_path[0];
+            z0 = _BdptVertex();
+            z0.type = _BdptVertex::camera_vertex;
+            z0.pos = camera->frame.o;
+            z0.pdf_fwd = 1;
+            auto cos_c = -dot(ray.d, camera->frame.z);
+            auto nc = _bdpt_walk(ctx, ray, cone, one3f, 1 / (ctx.image_area * cos_c * cos_c * cos_c), false, rng, camera_path, 1, c);
+            
+            for(auto t = 1; t <= nc; t ++) {
+                for(auto s = 0; s <= nl; s ++) {
+                    if(t == 1 and s <= 1) continue;
+                    auto uv = zero2f;
+                    auto cc = _bdpt_connect(ctx, light_path, s, camera_path, t, rng, uv);
+                    if(cc == zero3f) continue;
+                    if(t > 1) { c += cc; continue; }
+                    auto pi = clamp((int)(uv.x * w), 0, w-1), pj = clamp((int)(uv.y * h), 0, h-1);
+                    splats[j].push_back({(h-1-pj)*w+pi, cc});
+                }
+            }
+            buffer.accum.at(i,h-1-j) += c;
+            buffer.samples.at(i,h-1-j) += 1;
+        }
+    });
+    for(auto& row : splats) for(auto& sp : row) buffer.accum.at(sp.first % w, sp.first / w) += sp.second;
+}
+
+void pathtrace_scene_progressive(ImageBuffer& buffer, Scene* scene, PathtraceOptions& opts) {
+    auto w = buffer.width();
+    auto h = buffer.height();
+    auto cone = camera_ray_cone(scene->camera, h);
+    auto emitters = _pathtrace_emitters(scene, (opts.cameralights) ? scene->_cameralights : scene->lights);
+    auto nthreads = (opts.threads > 0) ? opts.threads : max(1,(int)std::thread::hardware_concurrency());
+
+    // one generator per row, or per chunk of the wavefront, so that images do not depend on the number of threads
+    auto nrngs = (opts.wavefront) ? max(h, (w*h + _pathtrace_wavefront_chunk - 1) / _pathtrace_wavefront_chunk) : h;
+    if(opts._rngs.size() != nrngs) opts._rngs = rng_generate_seeded(nrngs);
+
+    // photon maps are traced before the first pass, and again only if their inputs change
+    auto photon_lights = (opts.cameralights) ? scene->_cameralights : scene->lights;
+    if(opts.photons > 0 and not photonmap_traced_with(opts._photons.get(), photon_lights, opts.photons, opts.photons_final_gather, opts.doublesided, opts.reflections)) {
+        opts._photons = photonmap_trace(scene, photon_lights, opts.photons, opts.photons_final_gather, opts.doublesided, opts.reflections, opts.rng);
+    }
+
+    if(opts.bidirectional) { _pathtrace_bidirectional(buffer, scene, cone, opts, nthreads); return; }
+    if(opts.wavefront) { _pathtrace_wavefront(buffer, scene, cone, emitters, opts, nthreads); return; }
+
+    // rows are interleaved over the threads
+    int s2 = max(1,(int)sqrt(opts.samples));
+    _pathtrace_parallel(h, 1, nthreads, [&](int j, int, int) {
+        auto& rng = opts._rngs[j];
+        auto shadows = vector<_PathShadowRay>();
+        for(int i = 0; i < w; i ++) {
+            auto cs = buffer.samples.at(i,h-1-j);
+            auto ii = cs % s2; auto jj = (cs / s2) % s2;
+            float u = (i+(ii+rng.next_float())/s2)/w;
+            float v = (j+(jj+rng.next_float())/s2)/h;
+            ray3f ray = camera_ray(scene->camera,vec2f(u,v));
+            buffer.accum.at(i,h-1-j) += _pathtrace_ray(scene,ray,cone,emitters,opts,rng,shadows);
+            buffer.samples.at(i,h-1-j) += 1;
+        }
+    });
+}
@@ -2,6 +2,7 @@
 #define _PATHTRACE_H_
 
 #include "scene.h"
+#include "photonmap.h"
 
 ///@file igl/pathtrace.h Pathtracing. @ingroup igl
 ///@defgroup pathtrace Pathtracing
@@ -28,15 +29,29 @@ struct PathtraceOptions : Node {
     bool shadows = true; ///< whether to compute shadows
     bool indirect = true; ///< whether to compute indirect
     bool reflections = true; ///< whether to compute reflections
-    int indirect_samples = 16; ///< number of indirect samples
+    int indirect_samples = 16; ///< number of indirect samples (ignored: paths continue with a single brdf sample per vertex, raise samples instead)
     int shadow_samples = 16; ///< max number of shadow samples
     
     float image_scale = 1; ///< scale vaalue for image pixels
     float image_gamma = 1; ///< gamma value for image pixels
     
+    int threads = 0; ///< number of render threads (0 for the hardware concurrency)
+    bool bidirectional = false; ///< connect camera and light subpaths with MIS, splatting light tracing to the image (ignores indirect and ambient)
+    bool wavefront = false; ///< advance all paths one vertex at a time over ray queues instead of tracing them one by one
+    
+    int photons = 0; ///< photons emitted from the local lights, whose caustic map replaces the paths reaching them through mirrors (0: off)
+    int photons_lookup = 64; ///< nearest photons in each radiance estimate
+    float photons_radius = 0.1f; ///< maximum distance of the photons in each radiance estimate
+    bool photons_final_gather = false; ///< end paths after their first brdf bounce with the global photon map estimate (biased, much faster indirect)
+    
     Rng rng; ///< random number generator
+    vector<Rng> _rngs; ///< per image row (and wavefront chunk) generators, so that images do not depend on the number of threads
+    shared_ptr<PhotonMaps> _photons; ///< photon maps, traced before the first pass and shared by copies of the options
 };
 
+/// renders one sample per pixel with unidirectional pathtracing, in parallel over image rows or,
+/// with the wavefront option, over the ray queues of each stage
+void pathtrace_scene_progressive(ImageBuffer& buffer, Scene* scene, PathtraceOptions& opts);
 
 ///@}
 
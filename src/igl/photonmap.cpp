@@ -0,0 +1,168 @@
+#include "photonmap.h"
+
+#include "vmath/random.h"
+#include "intersect.h"
+
+#include <algorithm>
+
+///@file igl/photonmap.cpp Photon Mapping. @ingroup igl
+
+// balances photons [start,end) in place: the median along the longest axis of their bounds becomes the node of the range
+void _photonmap_balance(vector<Photon>& photons, int start, int end) {
+    if(end - start <= 1) return;
+    auto bbox = range3f();
+    for(auto i = start; i < end; i ++) bbox = runion(bbox, photons[i].pos);
+    auto bsize = size(bbox);
+    auto axis = (bsize.x >= bsize.y and bsize.x >= bsize.z) ? 0 : ((bsize.y >= bsize.z) ? 1 : 2);
+    auto mid = (start + end) / 2;
+    std::nth_element(photons.begin()+start, photons.begin()+mid, photons.begin()+end,
+                     [axis](const Photon& a, const Photon& b) { return a.pos[axis] < b.pos[axis]; });
+    photons[mid].axis = axis;
+    _photonmap_balance(photons, start, mid);
+    _photonmap_balance(photons, mid+1, end);
+}
+
+void photonmap_build(PhotonMap& map) {
+    _photonmap_balance(map.photons, 0, map.photons.size());
+}
+
+// follows a photon from the light along ray, storing it at the hits with brdf lobes, and continuing it
+// as in pathtracing with Russian roulette on the bounce weight, so that the stored powers stay about constant
+void _photonmap_trace_path(Scene* scene, ray3f ray, vec3f power, bool global, bool doublesided, bool reflections, Rng& rng, PhotonMaps* maps) {
+    auto mirror = false, diffuse = false;
+    for(auto bounce = 0; bounce < photonmap_max_bounces; bounce ++) {
+        intersection3f intersection;
+        if(not intersect_scene_first(scene,ray,intersection)) break;
+        auto wi = -ray.d;
+        auto frame = intersection.frame;
+        if(doublesided) frame = faceforward(frame,ray.d);
+        frame = material_shading_frame(intersection.material, frame, intersection.texcoord);
+        auto brdf = material_shading_textures(scene->_materials, intersection.material, intersection.texcoord, 0);
+
+        auto refl = (reflections) ? material_sample_reflection(brdf, frame, wi) : BrdfSample();
+        auto wr = mean_component(refl.brdfcos);
+        auto wb = mean_component(brdf.diffuse) + ((brdf.type == Brdf::phong) ? mean_component(brdf.specular) : 0.0f);
+        if(wb > 0) {
+            auto photon = Photon();
+            photon.pos = frame.o;
+            photon.wi = wi;
+            photon.power = power;
+            if(global) maps->global.photons.push_back(photon);
+            if(mirror and not diffuse) maps->caustic.photons.push_back(photon);
+        }
+        if(wr + wb <= 0) break;
+
+        auto pr = wr / (wr + wb);
+        auto w = zero3f;
+        if(rng.next_float() < pr) {
+            w = refl.brdfcos / pr;
+            mirror = true;
+            ray = ray3f(frame.o,refl.wi);
+        } else {
+            auto bs = material_sample_brdfcos(brdf, frame, wi, rng.next_float(), rng.next_vec2f());
+            if(bs.brdfcos == zero3f) break;
+            w = bs.brdfcos / ((1-pr) * bs.pdf);
+            // photons carry power, which is not symmetric with shading normals (Veach)
+            auto ng = normalize(intersection.geom_norm);
+            auto den = abs(dot(wi, ng)) * abs(dot(bs.wi, frame.z));
+            w *= (den > 0) ? abs(dot(wi, frame.z)) * abs(dot(bs.wi, ng)) / den : 0;
+            diffuse = true;
+            ray = ray3f(frame.o,bs.wi);
+        }
+        auto q = min(1.0f, max_component(w));
+        if(q <= 0 or rng.next_float() >= q) break;
+        power *= w / q;
+    }
+}
+
+shared_ptr<PhotonMaps> photonmap_trace(Scene* scene, LightGroup* lights, int count, bool global, bool doublesided, bool reflections, Rng& rng) {
+    auto maps = make_shared<PhotonMaps>();
+    maps->lights = lights;
+    maps->global_traced = global;
+    maps->doublesided = doublesided;
+    maps->reflections = reflections;
+    maps->emitted = count;
+    for(auto i = 0; i < count; i ++) {
+        auto ls = light_select_power(lights, rng.next_float());
+        if(ls.idx < 0 or ls.pdf <= 0) continue;
+        auto light = lights->lights[ls.idx];
+        // positions uniform on the lights, directions uniform for point lights and cosine distributed for area lights,
+        // so that the photon power is the light power over the selection probability
+        if(is<PointLight>(light)) {
+            auto ds = sample_direction_spherical(rng.next_vec2f());
+            auto power = cast<PointLight>(light)->intensity * (4*pif) / ls.pdf;
+            _photonmap_trace_path(scene, ray3f(light->frame.o, ds.dir), power, global, doublesided, reflections, rng, maps.get());
+        } else {
+            auto area = cast<AreaLight>(light);
+            auto sss = shape_sample_uniform(area->shape, rng.next_vec2f());
+            auto n = normalize(transform_direction(area->frame, sss.frame.z));
+            if(area->doublesided and rng.next_float() < 0.5f) n = -n;
+            auto ds = sample_direction_hemisphericalcos(rng.next_vec2f());
+            auto power = area->intensity * pif * sss.area * ((area->doublesided) ? 2 : 1) / ls.pdf;
+            _photonmap_trace_path(scene, ray3f(transform_point(area->frame, sss.frame.o), _material_lobe_direction(n, ds.dir)), power, global, doublesided, reflections, rng, maps.get());
+        }
+    }
+    photonmap_build(maps->global);
+    photonmap_build(maps->caustic);
+    return maps;
+}
+
+bool photonmap_traced_with(const PhotonMaps* maps, LightGroup* lights, int count, bool global, bool doublesided, bool reflections) {
+    return maps and maps->lights == lights and maps->emitted == count and maps->global_traced == global and
+           maps->doublesided == doublesided and maps->reflections == reflections;
+}
+
+// visits the kd-tree of photons [start,end), nearest side first, keeping the k nearest photons in a max heap
+// of squared distances, and shrinking radius2 to the farthest of them once k are found
+void _photonmap_lookup(const vector<Photon>& photons, int start, int end, const vec3f& p, int k, float& radius2, std::pair<float,int>* heap, int& count) {
+    if(start >= end) return;
+    auto mid = (start + end) / 2;
+    auto& photon = photons[mid];
+    if(end - start > 1) {
+        auto d = p[photon.axis] - photon.pos[photon.axis];
+        if(d < 0) {
+            _photonmap_lookup(photons, start, mid, p, k, radius2, heap, count);
+            if(d*d < radius2) _photonmap_lookup(photons, mid+1, end, p, k, radius2, heap, count);
+        } else {
+            _photonmap_lookup(photons, mid+1, end, p, k, radius2, heap, count);
+            if(d*d < radius2) _photonmap_lookup(photons, start, mid, p, k, radius2, heap, count);
+        }
+    }
+    auto dist2 = distSqr(photon.pos, p);
+    if(dist2 >= radius2) return;
+    if(count < k) {
+        heap[count++] = {dist2, mid};
+        std::push_heap(heap, heap+count);
+    } else {
+        std::pop_heap(heap, heap+count);
+        heap[count-1] = {dist2, mid};
+        std::push_heap(heap, heap+count);
+    }
+    if(count == k) radius2 = heap[0].first;
+}
+
+int photonmap_lookup(const PhotonMap& map, const vec3f& p, int k, float radius, int* nearest, float& radius2) {
+    std::pair<float,int> heap[photonmap_max_lookup];
+    auto count = 0;
+    radius2 = radius * radius;
+    _photonmap_lookup(map.photons, 0, map.photons.size(), p, clamp(k, 1, photonmap_max_lookup), radius2, heap, count);
+    for(auto i = 0; i < count; i ++) nearest[i] = heap[i].second;
+    return count;
+}
+
+vec3f photonmap_radiance(const PhotonMap& map, int emitted, const frame3f& frame, const Brdf& brdf, const vec3f& wo, int k, float radius) {
+    if(map.photons.empty() or emitted <= 0) return zero3f;
+    int nearest[photonmap_max_lookup];
+    auto radius2 = 0.0f;
+    auto n = photonmap_lookup(map, frame.o, k, radius, nearest, radius2);
+    if(n == 0 or radius2 <= 0) return zero3f;
+    // density estimate over the disc of the lookup, counting only the photons that came from the side of wo
+    auto c = zero3f;
+    for(auto i = 0; i < n; i ++) {
+        auto& photon = map.photons[nearest[i]];
+        auto cos_i = dot(photon.wi, frame.z);
+        if(cos_i <= 0) continue;
+        c += photon.power * material_brdfcos(brdf, frame, photon.wi, wo) / cos_i;
+    }
+    return c / (pif * radius2 * emitted);
+}
@@ -0,0 +1,66 @@
+#ifndef _PHOTONMAP_H_
+#define _PHOTONMAP_H_
+
+#include "scene.h"
+
+///@file igl/photonmap.h Photon Mapping. @ingroup igl
+///@defgroup photonmap Photon Mapping
+///@ingroup igl
+///@{
+
+/// photon stored at a surface hit
+struct Photon {
+    vec3f       pos = zero3f; ///< hit position
+    vec3f       wi = zero3f; ///< direction towards where the photon came from
+    vec3f       power = zero3f; ///< flux carried by the photon
+    int         axis = 0; ///< split axis of the kd-tree node of the photon
+};
+
+/// photons in a balanced kd-tree stored in a single array: each range has its node at its median,
+/// with the photons below the split on its left and the ones above on its right, so no pointers are needed
+struct PhotonMap {
+    vector<Photon>  photons; ///< photons, in kd-tree order once built
+};
+
+/// photon maps traced from the local lights (Jensen)
+struct PhotonMaps {
+    LightGroup*     lights = nullptr; ///< lights the photons were emitted from
+    bool            global_traced = false; ///< whether the global map was traced
+    bool            doublesided = false; ///< whether the photons were traced with double sided surfaces
+    bool            reflections = false; ///< whether the photons were traced through mirror reflections
+    int             emitted = 0; ///< photons emitted from the lights
+    PhotonMap       global; ///< photons at every hit with brdf lobes, for indirect lighting
+    PhotonMap       caustic; ///< photons that reached the brdf lobes only through mirror reflections, for caustics
+};
+
+/// photon paths are ended by Russian roulette, and by this many bounces
+const int photonmap_max_bounces = 16;
+
+/// photons gathered at most by a radiance estimate
+const int photonmap_max_lookup = 256;
+
+///@name photon mapping interface
+///@{
+
+/// balances the photons of a map into its kd-tree
+void photonmap_build(PhotonMap& map);
+
+/// traces count photons from the local lights, picked by power, and builds the caustic map and, if global is set, the global map
+shared_ptr<PhotonMaps> photonmap_trace(Scene* scene, LightGroup* lights, int count, bool global, bool doublesided, bool reflections, Rng& rng);
+
+/// whether the maps were traced by photonmap_trace with these inputs, so that they can be reused
+/// (scene edits are not tracked: drop the maps when editing the scene)
+bool photonmap_traced_with(const PhotonMaps* maps, LightGroup* lights, int count, bool global, bool doublesided, bool reflections);
+
+/// finds the (up to) k photons nearest to p within radius; returns their number, with their indices in nearest and
+/// the squared radius of the estimate in radius2 (the farthest photon if k are found, radius otherwise)
+int photonmap_lookup(const PhotonMap& map, const vec3f& p, int k, float radius, int* nearest, float& radius2);
+
+/// radiance reflected by the brdf lobes towards wo from the photons nearest to the frame origin
+vec3f photonmap_radiance(const PhotonMap& map, int emitted, const frame3f& frame, const Brdf& brdf, const vec3f& wo, int k, float radius);
+
+///@}
+
+///@}
+
+#endif
@@ -27,8 +27,9 @@ struct PrimitiveGroup : Node {
     
 	vector<Primitive*>       prims; ///< primitives
     
-    BVHAccelerator*         _intersect_accelerator = nullptr; ///< intersection accelerator
+    Accelerator*            _intersect_accelerator = nullptr; ///< intersection accelerator
     bool                    intersect_accelerator_use = true; ///< whether to use an intersection accelerator
+    string                  intersect_accelerator_type = "bvh"; ///< intersection accelerator type ("bvh" or "grid")
 };
 
 /// Basic Surface
@@ -70,6 +71,16 @@ mat4f transformed_matrix(TransformedSurface* transformed, float time);
 mat4f transformed_matrix_inv(TransformedSurface* transformed, float time);
 ///@}
 
+///@name shape access
+///@{
+/// shape of a primitive
+inline Shape* primitive_shape(Primitive* prim) {
+    if(is<Surface>(prim)) return cast<Surface>(prim)->shape;
+    else if(is<TransformedSurface>(prim)) return cast<TransformedSurface>(prim)->shape;
+    else { NOT_IMPLEMENTED_ERROR(); return nullptr; }
+}
+///@}
+
 ///@name animation interface
 ///@{
 range1f primitive_animation_interval(Primitive* prim);
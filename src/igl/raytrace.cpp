@@ -5,7 +5,20 @@
 
 ///@file igl/raytrace.cpp Raytracing. @ingroup igl
 
-vec3f _raytrace_scene_ray(Scene* scene, const ray3f& ray, const RaytraceOptions& opts, int depth) {
+// direct lighting from a light
+vec3f _raytrace_light(Scene* scene, Light* l, const frame3f& frame, const vec3f& wo, const Brdf& brdf, const RaytraceOptions& opts) {
+    auto ss = light_shadow_sample(l, frame.o, zero2f, false);
+    auto wi = ss.dir;
+    if(ss.radiance == zero3f) return zero3f;
+    vec3f cl = ss.radiance * material_brdfcos(brdf,frame,wi,wo) / ss.pdf;
+    if(cl == zero3f) return zero3f;
+    if(opts.shadows) {
+        if(not intersect_scene_occluded(scene,ray3f::segment(frame.o,frame.o+ss.dir*ss.dist),l)) return cl;
+        else return zero3f;
+    } else return cl;
+}
+
+vec3f _raytrace_scene_ray(Scene* scene, const ray3f& ray, const RayCone& cone, RaytraceOptions& opts, int depth) {
     // intersect
     intersection3f intersection;
     if(not intersect_scene_first(scene,ray,intersection)) return opts.background;
@@ -21,7 +34,9 @@ vec3f _raytrace_scene_ray(Scene* scene, const ray3f& ray, const RaytraceOptions&
     frame = material_shading_frame(material, frame, texcoord);
 
     // brdf
-    auto brdf = material_shading_textures(intersection.material, intersection.texcoord, length(frame.o - scene->camera->frame.o));
+    auto hit_cone = ray_cone_advance(cone, intersection.ray_t);
+    auto texcoord_width = hit_cone.width * intersection.texcoord_density / max(abs(dot(wo, intersection.frame.z)), 0.01f);
+    auto brdf = material_shading_textures(scene->_materials, intersection.material, intersection.texcoord, texcoord_width);
 
     // compute ambient
     vec3f c = zero3f;
@@ -32,15 +47,18 @@ vec3f _raytrace_scene_ray(Scene* scene, const ray3f& ray, const RaytraceOptions&
     
     // compute direct
     auto& ll = (opts.cameralights) ? scene->_cameralights : scene->lights;
+    auto select = opts.light_selection != "all" and not ll->_local.empty();
     for(auto l : ll->lights) {
-        auto ss = light_shadow_sample(l, frame.o, zero2f, false);
-        auto wi = ss.dir;
-        if(ss.radiance == zero3f) continue;
-        vec3f cl = ss.radiance * material_brdfcos(brdf,frame,wi,wo) / ss.pdf;
-        if(cl == zero3f) continue;
-        if(opts.shadows) {
-            if(not intersect_scene_any(scene,ray3f::segment(frame.o,frame.o+ss.dir*ss.dist))) c += cl;
-        } else c += cl;
+        if(select and light_is_local(l)) continue;
+        c += _raytrace_light(scene, l, frame, wo, brdf, opts);
+    }
+    // light selection: light_samples local lights picked by power or by the light bvh
+    if(select) {
+        for(int i = 0; i < opts.light_samples; i++) {
+            auto ls = light_select(ll, opts.light_selection, frame.o, frame.z, opts.rng.next_float());
+            if(ls.idx < 0) continue;
+            c += _raytrace_light(scene, ll->lights[ls.idx], frame, wo, brdf, opts) / (ls.pdf * opts.light_samples);
+        }
     }
     
     // recursively compute reflections
@@ -48,20 +66,18 @@ vec3f _raytrace_scene_ray(Scene* scene, const ray3f& ray, const RaytraceOptions&
         auto bs = material_sample_reflection(brdf, frame, wo);
         if(not (bs.brdfcos == zero3f)) {
             auto refl_ray = ray3f(frame.o,bs.wi);
-            c += _raytrace_scene_ray(scene, refl_ray, opts, depth+1) * bs.brdfcos;
+            c += _raytrace_scene_ray(scene, refl_ray, hit_cone, opts, depth+1) * bs.brdfcos;
         }
     }
     
-    // cleanup
-    delete brdf;
-    
     // done
     return c;
 }
 
-void raytrace_scene_progressive(ImageBuffer& buffer, Scene* scene, const RaytraceOptions& opts) {
+void raytrace_scene_progressive(ImageBuffer& buffer, Scene* scene, RaytraceOptions& opts) {
     auto w = buffer.width();
     auto h = buffer.height();
+    auto cone = camera_ray_cone(scene->camera, h);
     
     int s2 = max(1,(int)sqrt(opts.samples));
     for(int j = 0; j < h; j ++) {
@@ -71,7 +87,7 @@ void raytrace_scene_progressive(ImageBuffer& buffer, Scene* scene, const Raytrac
             float u = (i+(ii+0.5)/s2)/w;
             float v = (j+(jj+0.5)/s2)/h;
             ray3f ray = camera_ray(scene->camera,vec2f(u,v));
-            buffer.accum.at(i,h-1-j) += _raytrace_scene_ray(scene,ray,opts,0);
+            buffer.accum.at(i,h-1-j) += _raytrace_scene_ray(scene,ray,cone,opts,0);
             buffer.samples.at(i,h-1-j) += 1;
         }
     }
@@ -29,13 +29,16 @@ struct RaytraceOptions : Node {
     
     int max_depth = 4; ///< maximum ray recursion for reflections
     
+    string light_selection = "all"; ///< shade all lights, or light_samples local lights picked by "power" or by the light "bvh"
+    int light_samples = 1; ///< local lights picked per shading point with light selection
+    
     Rng rng; ///< random number generator
 };
 
 ///@name raytrace interface
 ///@{
 
-void raytrace_scene_progressive(ImageBuffer& buffer, Scene* scene, const RaytraceOptions& opts);
+void raytrace_scene_progressive(ImageBuffer& buffer, Scene* scene, RaytraceOptions& opts);
 
 ///@}
 
@@ -27,6 +27,8 @@ struct Scene : Node {
         
     GizmoGroup*         _defaultgizmos = nullptr;
     LightGroup*         _cameralights = nullptr;
+    vector<Light*>      _emitters; ///< area lights registered for emissive surfaces
+    MaterialTable*      _materials = nullptr;
 
     DrawOptions*        draw_opts = nullptr;
     RaytraceOptions*    raytrace_opts = nullptr;
@@ -53,6 +55,48 @@ inline void scene_defaultgizmos_init(Scene* scene) {
     scene->_defaultgizmos->gizmos.push_back(new Axes());
 }
 
+/// registers an area light for each emissive surface whose shape is not already an area light,
+/// so that emitters are sampled instead of being found by chance (textured emission uses its base color)
+inline void scene_emitters_init(Scene* scene) {
+    if(not scene->lights) scene->lights = new LightGroup();
+    auto& lights = scene->lights->lights;
+    for(auto light : scene->_emitters) {
+        // the emitter may have been removed from the lights already (e.g. by an edit)
+        auto pos = std::find(lights.begin(), lights.end(), light);
+        if(pos != lights.end()) lights.erase(pos);
+        delete light;
+    }
+    scene->_emitters.clear();
+    auto shapes = vector<Shape*>();
+    for(auto light : lights) if(is<AreaLight>(light)) shapes.push_back(cast<AreaLight>(light)->shape);
+    for(auto prim : scene->prims->prims) {
+        if(not prim->material or not is<LambertEmission>(prim->material)) continue;
+        auto emission = cast<LambertEmission>(prim->material)->emission;
+        if(emission == zero3f) continue;
+        if(not is<Surface>(prim)) { WARNING("emissive transformed surfaces are not registered as lights"); continue; }
+        auto shape = cast<Surface>(prim)->shape;
+        if(std::find(shapes.begin(), shapes.end(), shape) != shapes.end()) continue;
+        auto light = new AreaLight();
+        light->frame = prim->frame;
+        light->shape = shape;
+        light->intensity = emission;
+        // surfaces are shaded doublesided by default, so they are seen emitting on both sides
+        light->doublesided = true;
+        lights.push_back(light);
+        scene->_emitters.push_back(light);
+    }
+}
+
+/// compiles the materials of the primitives into the scene material table, replacing the previous one
+/// (call again after editing materials, since the table does not follow them)
+inline void scene_materials_init(Scene* scene) {
+    if(scene->_materials) delete scene->_materials;
+    scene->_materials = new MaterialTable();
+    for(auto prim : scene->prims->prims) {
+        if(prim->material) material_table_add(scene->_materials, prim->material);
+    }
+}
+
 inline void scene_cameralights_update(Scene* scene, const vector<vec3f>& dir, const vector<vec3f>& c) {
     if(not scene->_cameralights) scene->_cameralights = new LightGroup();
     if(scene->_cameralights->lights.size() != dir.size()) {
@@ -5,9 +5,66 @@
 #include "distraytrace.h"
 #include "pathtrace.h"
 
+#include <sys/stat.h>
+
 ///@file igl/serialize.cpp Serialization. @ingroup igl
 
 Serializer::_Registry Serializer::_registry;
+Serializer::_Resources Serializer::_resources;
+
+string Serializer::resource_key(const string& kind, const string& filename) {
+    struct stat st;
+    if(stat(filename.c_str(), &st) != 0) return kind + ":" + filename;
+    char buf[128]; sprintf(buf, ":%llx:%llx:%llx:%llx", (unsigned long long)st.st_dev, (unsigned long long)st.st_ino,
+                           (unsigned long long)st.st_size, (unsigned long long)st.st_mtime);
+    return kind + buf;
+}
+
+template<typename T>
+long long _vector_bytes(const vector<T>& v) { return v.size() * sizeof(T); }
+
+long long serialize_shape_bytes(Shape* shape) {
+    if(is<PointSet>(shape)) {
+        auto s = cast<PointSet>(shape);
+        return _vector_bytes(s->pos) + _vector_bytes(s->radius) + _vector_bytes(s->texcoord);
+    }
+    else if(is<LineSet>(shape)) {
+        auto s = cast<LineSet>(shape);
+        return _vector_bytes(s->pos) + _vector_bytes(s->radius) + _vector_bytes(s->texcoord) + _vector_bytes(s->line);
+    }
+    else if(is<TriangleMesh>(shape)) {
+        auto s = cast<TriangleMesh>(shape);
+        return _vector_bytes(s->pos) + _vector_bytes(s->norm) + _vector_bytes(s->texcoord) + _vector_bytes(s->triangle);
+    }
+    else if(is<Mesh>(shape)) {
+        auto s = cast<Mesh>(shape);
+        return _vector_bytes(s->pos) + _vector_bytes(s->norm) + _vector_bytes(s->texcoord) +
+               _vector_bytes(s->triangle) + _vector_bytes(s->quad);
+    }
+    else if(is<FaceMesh>(shape)) {
+        auto s = cast<FaceMesh>(shape);
+        return _vector_bytes(s->pos) + _vector_bytes(s->norm) + _vector_bytes(s->texcoord) +
+               _vector_bytes(s->vertex) + _vector_bytes(s->triangle) + _vector_bytes(s->quad);
+    }
+    else if(is<CatmullClarkSubdiv>(shape)) {
+        auto s = cast<CatmullClarkSubdiv>(shape);
+        return _vector_bytes(s->pos) + _vector_bytes(s->norm) + _vector_bytes(s->texcoord) + _vector_bytes(s->quad);
+    }
+    else if(is<Subdiv>(shape)) {
+        auto s = cast<Subdiv>(shape);
+        return _vector_bytes(s->pos) + _vector_bytes(s->norm) + _vector_bytes(s->texcoord) + _vector_bytes(s->triangle) +
+               _vector_bytes(s->quad) + _vector_bytes(s->crease_edge) + _vector_bytes(s->crease_vertex);
+    }
+    else if(is<Spline>(shape)) {
+        auto s = cast<Spline>(shape);
+        return _vector_bytes(s->pos) + _vector_bytes(s->radius) + _vector_bytes(s->texcoord) + _vector_bytes(s->cubic);
+    }
+    else if(is<Patch>(shape)) {
+        auto s = cast<Patch>(shape);
+        return _vector_bytes(s->pos) + _vector_bytes(s->texcoord) + _vector_bytes(s->cubic);
+    }
+    else return 0;
+}
 
 void Serializer::register_object_types() {
     static bool done = false;
@@ -131,6 +188,7 @@ void serialize_members(Node* node, Serializer& ser) {
         auto shape = cast<Shape>(node);
         if(not shape) ERROR("node is null");
         ser.serialize_member("intersect_accelerator_use",shape->intersect_accelerator_use);
+        ser.serialize_member("intersect_accelerator_type",shape->intersect_accelerator_type);
         if(is<PointSet>(node)) {
             auto points = cast<PointSet>(node);
             ser.serialize_member("pos",points->pos);
@@ -266,10 +324,8 @@ void serialize_members(Node* node, Serializer& ser) {
             ser.serialize_member("exponent",phong->exponent);
             ser.serialize_member("texture_mapping",phong->texture_mapping);
             ser.serialize_member("trilinear",phong->trilinear);
+            ser.serialize_member("texcoord_scale",phong->texcoord_scale);
             ser.serialize_member("diffuse_texture",phong->diffuse_texture);
-            ser.serialize_member("diffuse_texture_tri_1",phong->diffuse_texture_tri_1);
-            ser.serialize_member("diffuse_texture_tri_2",phong->diffuse_texture_tri_2);
-            ser.serialize_member("diffuse_texture_tri_3",phong->diffuse_texture_tri_3);
             ser.serialize_member("specular_texture",phong->specular_texture);
             ser.serialize_member("reflection_texture",phong->reflection_texture);
             ser.serialize_member("exponent_texture",phong->exponent_texture);
@@ -312,6 +368,7 @@ void serialize_members(Node* node, Serializer& ser) {
             ser.serialize_member("intensity",area->intensity);
             ser.serialize_member("shape",area->shape);
             ser.serialize_member("shadow_samples",area->shadow_samples);
+            ser.serialize_member("doublesided",area->doublesided);
         }
         else if(is<EnvLight>(node)) {
             auto env = cast<EnvLight>(node);
@@ -319,6 +376,9 @@ void serialize_members(Node* node, Serializer& ser) {
             ser.serialize_member("envmap",env->envmap);
             ser.serialize_member("shadow_samples",env->shadow_samples);
             ser.serialize_member("hemisphere",env->hemisphere);
+            ser.serialize_member("importance_sampling",env->importance_sampling);
+            ser.serialize_member("irradiance_sh",env->irradiance_sh);
+            ser.serialize_member("occlusion_samples",env->occlusion_samples);
         }
         else NOT_IMPLEMENTED_ERROR();
     }
@@ -352,15 +412,27 @@ void serialize_members(Node* node, Serializer& ser) {
         auto group = cast<PrimitiveGroup>(node);
         ser.serialize_member("prims",group->prims);
         ser.serialize_member("intersect_accelerator_use",group->intersect_accelerator_use);
+        ser.serialize_member("intersect_accelerator_type",group->intersect_accelerator_type);
     }
     else if(is<Texture>(node)) {
         auto texture = cast<Texture>(node);
         ser.serialize_member("filename",texture->filename);
         ser.serialize_member("flipy",texture->flipy);
-        if(ser.is_reading()) texture->image = imageio_read_auto3f(texture->filename,texture->flipy);
+        ser.serialize_member("format",texture->format);
+        if(ser.is_reading()) {
+            // textures of the same file and storage are loaded once
+            auto key = Serializer::resource_key(string("texture:") + texture->format + ":" + (texture->flipy ? "flipy" : "noflip"), texture->filename);
+            ser._resource_shared = ser.resource_get(key);
+            if(not ser._resource_shared) {
+                auto load_timer = timer();
+                texture_load(texture);
+                ser.resource_add(key, texture, texture_bytes(texture), load_timer.elapsed());
+            }
+        }
         else if(ser.is_writing_externals()) {
-            if(texture->image.width() > 0 and texture->image.height() > 0) {
-                imageio_write_auto(texture->filename,texture->image,texture->flipy);
+            auto image = texture_image(texture);
+            if(image.width() > 0 and image.height() > 0) {
+                imageio_write_auto(texture->filename,image,texture->flipy);
             }
         }
     }
@@ -445,6 +517,8 @@ void serialize_members(Node* node, Serializer& ser) {
         ser.serialize_member("max_depth", opts->max_depth);
         ser.serialize_member("shadows", opts->shadows);
         ser.serialize_member("reflections", opts->reflections);
+        ser.serialize_member("light_selection", opts->light_selection);
+        ser.serialize_member("light_samples", opts->light_samples);
     }
     else if(is<DistributionRaytraceOptions>(node)) {
         auto opts = cast<DistributionRaytraceOptions>(node);
@@ -465,6 +539,15 @@ void serialize_members(Node* node, Serializer& ser) {
         ser.serialize_member("reflections", opts->reflections);
         ser.serialize_member("samples_ambient", opts->samples_ambient);
         ser.serialize_member("samples_reflect", opts->samples_reflect);
+        ser.serialize_member("light_selection", opts->light_selection);
+        ser.serialize_member("light_samples", opts->light_samples);
+        ser.serialize_member("adaptive_shadows", opts->adaptive_shadows);
+        ser.serialize_member("adaptive_shadows_min", opts->adaptive_shadows_min);
+        ser.serialize_member("adaptive_shadows_solidangle", opts->adaptive_shadows_solidangle);
+        ser.serialize_member("photons", opts->photons);
+        ser.serialize_member("photons_lookup", opts->photons_lookup);
+        ser.serialize_member("photons_radius", opts->photons_radius);
+        ser.serialize_member("photons_gather", opts->photons_gather);
     }
     else if(is<PathtraceOptions>(node)) {
         auto opts = cast<PathtraceOptions>(node);
@@ -485,6 +568,13 @@ void serialize_members(Node* node, Serializer& ser) {
         ser.serialize_member("indirect_samples", opts->indirect_samples);
         ser.serialize_member("image_scale", opts->image_scale);
         ser.serialize_member("image_gamma", opts->image_gamma);
+        ser.serialize_member("threads", opts->threads);
+        ser.serialize_member("bidirectional", opts->bidirectional);
+        ser.serialize_member("wavefront", opts->wavefront);
+        ser.serialize_member("photons", opts->photons);
+        ser.serialize_member("photons_lookup", opts->photons_lookup);
+        ser.serialize_member("photons_radius", opts->photons_radius);
+        ser.serialize_member("photons_final_gather", opts->photons_final_gather);
     }
     else NOT_IMPLEMENTED_ERROR();
 }
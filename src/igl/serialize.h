@@ -23,6 +23,8 @@ struct Serializer;
 const char* serialize_typename(Node* node);
 /// serialize object member via the serializer 
 void serialize_members(Node* node, Serializer& ser);
+/// memory held by the shape data, for load statistics
+long long serialize_shape_bytes(Shape* shape);
 ///@}
 
 /// Serializer object
@@ -55,8 +57,10 @@ struct Serializer {
     
     template<typename T>
     static void read(T& value, StructuredStream* ser) {
+        if(_resources.depth++ == 0) _resources_reset();
         auto s = Serializer(ser,false);
         s.serialize(value);
+        _resources.depth--;
     }
     
     template<typename T>
@@ -201,7 +205,14 @@ struct Serializer {
             if(_ser->struct_has_member("_include")) {
                 string filename;
                 serialize_member("_include",filename);
-                read_json(value,filename);
+                // included shapes are shared by all the includes of the same file
+                auto key = resource_key("include", filename);
+                value = dynamic_cast<T*>(resource_get(key));
+                if(not value) {
+                    auto load_timer = timer();
+                    read_json(value,filename);
+                    if(auto shape = dynamic_cast<Shape*>(value)) resource_add(key, shape, serialize_shape_bytes(shape), load_timer.elapsed());
+                }
             } else if(_ser->struct_has_member("_ref")) {
                 int ref;
                 serialize_member("_ref",ref);
@@ -214,12 +225,24 @@ struct Serializer {
                 string type;
                 serialize_member("_type",type);
                 _registry.make_new(value,type);
+                int id = 0;
                 if(_ser->struct_has_member("_id")) {
-                    int id;
                     serialize_member("_id",id);
                     _object_map.add(value,id);
                 }
                 serialize_members(value,*this);
+                // serialize_members found the same resource already loaded, so share it
+                if(_resource_shared) {
+                    auto shared = dynamic_cast<T*>(_resource_shared);
+                    _resource_shared = nullptr;
+                    if(shared) {
+                        // forget the discarded node, whose address may be reused by later allocations
+                        _object_map.remove(value);
+                        delete value;
+                        value = shared;
+                        if(id) _object_map.add(value,id);
+                    }
+                }
             }
             _ser->struct_end();
         } else {
@@ -259,6 +282,7 @@ struct Serializer {
         
         void add(Node* obj) { int tag = cur_tag; obj2tag[obj] = tag; tag2obj[tag] = obj; cur_tag++; }
         void add(Node* obj, int tag) { obj2tag[obj] = tag; tag2obj[tag] = obj; }
+        void remove(Node* obj) { obj2tag.erase(obj); }
         Node* get_obj(int tag) { if(tag2obj.find(tag) == tag2obj.end()) return 0; else return tag2obj[tag]; }
         int get_tag(Node* obj) { if(obj2tag.find(obj) == obj2tag.end()) return 0; else return obj2tag[obj]; }
     };
@@ -284,6 +308,54 @@ struct Serializer {
     };
     static _Registry _registry;
     ///@}
+    
+    ///@name resource sharing
+    ///@{
+    /// load-time sharing statistics
+    struct ResourceStats {
+        int             loaded = 0; ///< textures and included shapes loaded
+        int             shared = 0; ///< references resolved to an already loaded resource
+        long long       bytes_saved = 0; ///< memory not duplicated by sharing
+        double          seconds_saved = 0; ///< load time not spent by sharing
+    };
+    
+    /// statistics of the last read
+    static ResourceStats resource_stats() { return _resources.stats; }
+    
+    /// key identifying a file (device, inode, size and time), so different paths to the same file match
+    static string resource_key(const string& kind, const string& filename);
+    
+    /// loaded resource for a key (nullptr if none), counting the savings
+    Node* resource_get(const string& key) {
+        auto it = _resources.nodes.find(key);
+        if(it == _resources.nodes.end()) return nullptr;
+        _resources.stats.shared ++;
+        _resources.stats.bytes_saved += it->second.bytes;
+        _resources.stats.seconds_saved += it->second.seconds;
+        return it->second.node;
+    }
+    
+    /// register a loaded resource
+    void resource_add(const string& key, Node* node, long long bytes, double seconds) {
+        _resources.nodes[key] = _Resource{node, bytes, seconds};
+        _resources.stats.loaded ++;
+    }
+    
+    struct _Resource {
+        Node*           node; ///< loaded node
+        long long       bytes; ///< node memory
+        double          seconds; ///< load time
+    };
+    struct _Resources {
+        std::map<string,_Resource> nodes; ///< loaded resources by key
+        ResourceStats   stats; ///< sharing statistics
+        int             depth = 0; ///< nested reads (resources are shared within the outermost one)
+    };
+    static _Resources _resources;
+    static void _resources_reset() { _resources.nodes.clear(); _resources.stats = ResourceStats(); }
+    
+    Node*       _resource_shared = nullptr; ///< resource found while reading members, replacing the object read
+    ///@}
 };
 
 ///@}
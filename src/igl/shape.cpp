@@ -1,5 +1,7 @@
 #include "shape.h"
 
+#include "vmath/montecarlo.h"
+
 ///@file igl/shape.cpp Shapes. @ingroup igl
 
 Shape* shape_clone(Shape* shape) {
@@ -173,8 +175,85 @@ frame3f facemesh_frame(FaceMesh* mesh, int elementid, const vec2f& uv) {
     return ff;
 }
 
+// number of triangles of a mesh (quads count as two)
+int _shape_sample_triangles(Shape* shape) {
+    if(is<TriangleMesh>(shape)) return cast<TriangleMesh>(shape)->triangle.size();
+    else if(is<Mesh>(shape)) return cast<Mesh>(shape)->triangle.size() + 2*cast<Mesh>(shape)->quad.size();
+    else if(is<FaceMesh>(shape)) return cast<FaceMesh>(shape)->triangle.size() + 2*cast<FaceMesh>(shape)->quad.size();
+    else return 0;
+}
+
+// vertex positions of a mesh triangle
+void _shape_sample_triangle(Shape* shape, int elementid, vec3f& v0, vec3f& v1, vec3f& v2) {
+    if(is<TriangleMesh>(shape)) {
+        auto mesh = cast<TriangleMesh>(shape);
+        auto f = mesh->triangle[elementid];
+        v0 = mesh->pos[f.x]; v1 = mesh->pos[f.y]; v2 = mesh->pos[f.z];
+    } else if(is<Mesh>(shape)) {
+        auto mesh = cast<Mesh>(shape);
+        auto f = mesh_triangle_face(mesh, elementid);
+        v0 = mesh->pos[f.x]; v1 = mesh->pos[f.y]; v2 = mesh->pos[f.z];
+    } else if(is<FaceMesh>(shape)) {
+        auto mesh = cast<FaceMesh>(shape);
+        auto f = facemesh_triangle_face(mesh, elementid);
+        v0 = mesh->pos[mesh->vertex[f.x].x]; v1 = mesh->pos[mesh->vertex[f.y].x]; v2 = mesh->pos[mesh->vertex[f.z].x];
+    } else NOT_IMPLEMENTED_ERROR();
+}
+
+// uniform point on a triangle, with the geometric normal
+ShapeSample _shape_sample_triangle_uniform(const vec3f& v0, const vec3f& v1, const vec3f& v2, const vec2f& uv) {
+    auto su = sqrt(uv.x);
+    auto sss = ShapeSample();
+    sss.frame.o = v0 * (1 - su) + v1 * (su * (1 - uv.y)) + v2 * (su * uv.y);
+    sss.frame.z = triangle_normal(v0, v1, v2);
+    sss.frame = orthonormalize(sss.frame);
+    sss.area = triangle_area(v0, v1, v2);
+    return sss;
+}
+
+void shape_sample_init(Shape* shape) {
+    if(shape->_tesselation) { shape_sample_init(shape->_tesselation); return; }
+    auto ntriangles = _shape_sample_triangles(shape);
+    shape->_sample_distribution = nullptr;
+    if(not ntriangles) return;
+    auto areas = vector<float>(ntriangles);
+    vec3f v0, v1, v2;
+    for(auto i : range(ntriangles)) {
+        _shape_sample_triangle(shape, i, v0, v1, v2);
+        areas[i] = triangle_area(v0, v1, v2);
+    }
+    shape->_sample_distribution = make_shared<Distribution1D>(sample_init_distribution1d(areas));
+}
+
 ShapeSample shape_sample_uniform(Shape* shape, const vec2f& uv) {
-    if(is<Sphere>(shape)) {
+    if(shape->_tesselation) return shape_sample_uniform(shape->_tesselation, uv);
+    if(_shape_sample_triangles(shape)) {
+        ERROR_IF_NOT(shape->_sample_distribution, "shape sampling not initialized");
+        auto dist = shape->_sample_distribution.get();
+        // the alias table picks a triangle by area and leaves a uniform value within it
+        auto ds = sample_distribution1d(dist, uv.x);
+        auto n = dist->values.size();
+        vec3f v0, v1, v2;
+        _shape_sample_triangle(shape, ds.index, v0, v1, v2);
+        auto sss = _shape_sample_triangle_uniform(v0, v1, v2, vec2f(clamp(ds.value*n - ds.index, 0.0f, 1.0f), uv.y));
+        sss.area = dist->integral * n;
+        return sss;
+    }
+    else if(is<Triangle>(shape)) {
+        auto triangle = cast<Triangle>(shape);
+        return _shape_sample_triangle_uniform(triangle->v0, triangle->v1, triangle->v2, uv);
+    }
+    else if(is<Cylinder>(shape)) {
+        auto cylinder = cast<Cylinder>(shape);
+        auto phi = 2*pif*uv.x;
+        auto sss = ShapeSample();
+        sss.frame.o = vec3f(cylinder->radius*cos(phi), cylinder->radius*sin(phi), uv.y*cylinder->height);
+        sss.frame.z = vec3f(cos(phi), sin(phi), 0);
+        sss.frame = orthonormalize(sss.frame);
+        sss.area = 2*pif*cylinder->radius*cylinder->height;
+        return sss;
+    }
+    else if(is<Sphere>(shape)) {
         auto sphere = cast<Sphere>(shape);
         // see: http://mathworld.wolfram.com/SpherePointPicking.html
         float z = 1 - 2*uv.y;
@@ -8,17 +8,20 @@
 ///@ingroup igl
 ///@{
 
-struct BVHAccelerator;
+struct Accelerator;
 struct Texture;
+struct Distribution1D;
 
 /// Abstract Shape
 struct Shape : Node {
     REGISTER_FAST_RTTI(Node,Shape,14)
     
-    BVHAccelerator*     _intersect_accelerator = nullptr; ///< intersection accelerator
+    Accelerator*        _intersect_accelerator = nullptr; ///< intersection accelerator
     bool                intersect_accelerator_use = true; ///< whether to use the intersection accelerator
+    string              intersect_accelerator_type = "bvh"; ///< intersection accelerator type ("bvh" or "grid")
 
     Shape*              _tesselation = nullptr; ///< shape tesselation
+    shared_ptr<Distribution1D> _sample_distribution; ///< triangles by area, for uniform sampling of meshes (rebuilt by shape_sample_init, never modified, so clones may share it)
 };
 
 /// Sphere aligned along Z axis
@@ -297,6 +300,8 @@ struct ShapeSample {
     float       area = 1; ///< shape area
 };
 
+/// init uniform sampling, recomputing the triangle areas of meshes (call again after editing the shape)
+void shape_sample_init(Shape* shape);
 ShapeSample shape_sample_uniform(Shape* shape, const vec2f& uv);
 ///@}
 
@@ -1,5 +1,7 @@
 #include "tesselate.h"
 
+#include <unordered_set>
+
 ///@file igl/tesselate.cpp Tesselation. @ingroup igl
 
 Shape* _tesselate_shape_uniform(const function<frame3f (const vec2f&)> shape_frame,
@@ -669,7 +671,11 @@ void primitive_tesselation_init(Primitive* prim, bool override, int override_lev
 }
 
 void primitives_tesselation_init(PrimitiveGroup* group, bool override, int override_level, bool override_smooth) {
-    for(auto p : group->prims) primitive_tesselation_init(p,override,override_level,override_smooth);
+    // shapes shared by several primitives are tesselated once
+    std::unordered_set<Shape*> shapes;
+    for(auto p : group->prims) {
+        if(shapes.insert(primitive_shape(p)).second) primitive_tesselation_init(p,override,override_level,override_smooth);
+    }
 }
 
 void scene_tesselation_init(Scene* scene, bool override, int override_level, bool override_smooth) {
@@ -1,3 +1,306 @@
 #include "texture.h"
 
+#include <atomic>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
 ///@file igl/texture.cpp Textures. @ingroup igl
+
+TextureStats _texture_stats; ///< texture memory counters (textures are loaded serially)
+
+TextureTiles::Format texture_format_parse(const string& format, const string& filename) {
+    if(format == "float") return TextureTiles::rgbf;
+    else if(format == "rgb8") return TextureTiles::rgb8;
+    else if(format == "rgb565") return TextureTiles::rgb565;
+    else if(format == "half") return TextureTiles::rgbh;
+    else if(format == "auto") {
+        if(string_endswith(filename,"png") or string_endswith(filename,"ppm")) return TextureTiles::rgb8;
+        else return TextureTiles::rgbf;
+    }
+    else { WARNING("unknown texture format %s, using float", format.c_str()); return TextureTiles::rgbf; }
+}
+
+TextureTiles texture_tiles_make(const image3f& img, TextureTiles::Format format) {
+    auto tiles = TextureTiles();
+    tiles.format = format;
+    tiles.texel_bytes = texture_format_bytes(format);
+    tiles.width = img.width();
+    tiles.height = img.height();
+    tiles.tiles_x = (img.width() + TextureTiles::tile_size - 1) / TextureTiles::tile_size;
+    auto tiles_y = (img.height() + TextureTiles::tile_size - 1) / TextureTiles::tile_size;
+    tiles.data.assign(tiles.tiles_x * tiles_y * TextureTiles::tile_size * TextureTiles::tile_size * tiles.texel_bytes, 0);
+    for(auto j : range(img.height())) {
+        for(auto i : range(img.width())) {
+            texture_format_encode(format, img.at(i,j), tiles.data.data() + texture_tiles_index(tiles, i, j) * tiles.texel_bytes);
+        }
+    }
+    return tiles;
+}
+
+void texture_levels_init(Texture* texture) {
+    texture->_levels.clear();
+    if(texture->image.width() == 0 or texture->image.height() == 0) return;
+    auto format = texture_format_parse(texture->format, texture->filename);
+    texture->_levels.push_back(texture_tiles_make(texture->image, format));
+    auto prev = texture->image;
+    while(prev.width() > 1 or prev.height() > 1) {
+        auto w = max(1,prev.width()/2), h = max(1,prev.height()/2);
+        auto mip = image3f(w,h);
+        for(auto j : range(h)) {
+            for(auto i : range(w)) {
+                auto i1 = min(2*i+1,prev.width()-1), j1 = min(2*j+1,prev.height()-1);
+                mip.at(i,j) = (prev.at(2*i,2*j) + prev.at(i1,2*j) + prev.at(2*i,j1) + prev.at(i1,j1)) / 4;
+            }
+        }
+        texture->_levels.push_back(texture_tiles_make(mip, format));
+        prev = mip;
+    }
+    texture->image = image3f();
+}
+
+string TextureCache::cache_dir = "";
+long long TextureCache::budget = 256ll << 20;
+
+const unsigned int _texture_cache_magic = 0x58455431; // "1TEX"
+const unsigned int _texture_cache_version = 1;
+
+struct _TextureCacheHeader { unsigned int magic, version; int format, level_num; unsigned long long key; };
+struct _TextureCacheLevel { int width, height, tiles_x, texel_bytes; long long bytes; };
+
+int _texture_cache_next_id = 0; ///< next paged level id (textures are loaded serially)
+
+// fnv-1a over raw bytes
+unsigned long long _texture_cache_hash(unsigned long long h, const void* data, size_t size) {
+    auto bytes = (const unsigned char*)data;
+    for(auto i : range(size)) { h ^= bytes[i]; h *= 1099511628211ull; }
+    return h;
+}
+
+// the levels only depend on the file contents and the storage parameters; size and time stand for the contents
+unsigned long long texture_cache_key(Texture* texture, TextureTiles::Format format) {
+    struct stat st;
+    if(stat(texture->filename.c_str(), &st) != 0) return 0;
+    unsigned long long h = 14695981039346656037ull;
+    int params[] = { (int)_texture_cache_version, TextureTiles::tile_bits, (int)format, (int)texture->flipy };
+    long long file[] = { (long long)st.st_size, (long long)st.st_mtime };
+    h = _texture_cache_hash(h, params, sizeof(params));
+    h = _texture_cache_hash(h, file, sizeof(file));
+    h = _texture_cache_hash(h, texture->filename.c_str(), texture->filename.size());
+    return h;
+}
+
+string texture_cache_filename(unsigned long long key) {
+    char buf[64]; sprintf(buf, "tex_%016llx.texcache", key);
+    return TextureCache::cache_dir + "/" + buf;
+}
+
+// reads the level layout only; texels stay on disk and are paged in by lookups
+bool texture_cache_open(Texture* texture, unsigned long long key) {
+    auto fd = open(texture_cache_filename(key).c_str(), O_RDONLY);
+    if(fd < 0) return false;
+    auto header = _TextureCacheHeader();
+    bool ok = pread(fd, &header, sizeof(header), 0) == sizeof(header) and
+              header.magic == _texture_cache_magic and header.version == _texture_cache_version and
+              header.key == key and header.level_num > 0;
+    auto levels = vector<_TextureCacheLevel>((ok) ? header.level_num : 0);
+    if(ok) ok = pread(fd, levels.data(), sizeof(_TextureCacheLevel)*levels.size(), sizeof(header)) == sizeof(_TextureCacheLevel)*levels.size();
+    if(not ok) {
+        WARNING("corrupted texture cache %s, reloading", texture_cache_filename(key).c_str());
+        close(fd);
+        return false;
+    }
+    texture_release(texture);
+    auto offset = (long long)(sizeof(header) + sizeof(_TextureCacheLevel)*levels.size());
+    for(auto& level : levels) {
+        auto tiles = TextureTiles();
+        tiles.format = (TextureTiles::Format)header.format;
+        tiles.texel_bytes = level.texel_bytes;
+        tiles.width = level.width;
+        tiles.height = level.height;
+        tiles.tiles_x = level.tiles_x;
+        tiles._cache_id = _texture_cache_next_id ++;
+        tiles._page_fd = fd;
+        tiles._page_offset = offset;
+        auto row_bytes = level.tiles_x * TextureTiles::tile_size * TextureTiles::tile_size * level.texel_bytes;
+        tiles._page_bytes = max(1, TextureCache::page_bytes / row_bytes) * row_bytes;
+        tiles._page_total = level.bytes;
+        texture->_levels.push_back(tiles);
+        offset += level.bytes;
+    }
+    texture->image = image3f();
+    return true;
+}
+
+void texture_cache_write(Texture* texture, unsigned long long key) {
+    auto filename = texture_cache_filename(key);
+    // write to a temporary and rename so concurrent renders never read partial files
+    auto tmpname = filename + ".tmp";
+    auto f = fopen(tmpname.c_str(), "wb");
+    if(not f) { WARNING("cannot write texture cache %s", filename.c_str()); return; }
+    auto header = _TextureCacheHeader{ _texture_cache_magic, _texture_cache_version,
+                                       (int)texture->_levels[0].format, (int)texture->_levels.size(), key };
+    bool ok = fwrite(&header, sizeof(header), 1, f) == 1;
+    for(auto& tiles : texture->_levels) {
+        auto level = _TextureCacheLevel{ tiles.width, tiles.height, tiles.tiles_x, tiles.texel_bytes, (long long)tiles.data.size() };
+        ok = ok and fwrite(&level, sizeof(level), 1, f) == 1;
+    }
+    for(auto& tiles : texture->_levels) ok = ok and fwrite(tiles.data.data(), 1, tiles.data.size(), f) == tiles.data.size();
+    fclose(f);
+    if(ok) ok = rename(tmpname.c_str(), filename.c_str()) == 0;
+    if(not ok) { WARNING("cannot write texture cache %s", filename.c_str()); remove(tmpname.c_str()); }
+}
+
+void texture_load(Texture* texture) {
+    auto cached = not TextureCache::cache_dir.empty();
+    auto key = (cached) ? texture_cache_key(texture, texture_format_parse(texture->format, texture->filename)) : 0ull;
+    if(not cached or key == 0 or not texture_cache_open(texture, key)) {
+        texture->image = imageio_read_auto3f(texture->filename,texture->flipy);
+        texture_levels_init(texture);
+        if(cached and key != 0 and not texture->_levels.empty()) {
+            texture_cache_write(texture, key);
+            texture_cache_open(texture, key);
+        }
+    }
+    if(texture->_levels.empty()) return;
+    
+    _texture_stats.textures ++;
+    for(auto& level : texture->_levels) {
+        auto bytes = (level._cache_id >= 0) ? level._page_total : (long long)level.data.size();
+        if(level._cache_id >= 0) _texture_stats.paged_bytes += bytes;
+        else _texture_stats.bytes += bytes;
+        _texture_stats.float_bytes += bytes / level.texel_bytes * sizeof(vec3f);
+    }
+}
+
+void texture_release(Texture* texture) {
+    for(auto& level : texture->_levels) {
+        if(level._page_fd >= 0) { close(level._page_fd); break; }
+    }
+    texture->_levels.clear();
+}
+
+Texture::~Texture() { texture_release(this); }
+
+struct _TexturePage {
+    unsigned long long                  key; ///< level id and page index
+    shared_ptr<vector<unsigned char>>   data; ///< page texels
+};
+
+struct _TextureCacheShard {
+    std::mutex                          mutex; ///< lock for the shard
+    std::list<_TexturePage>             lru; ///< resident pages, most recently used first
+    std::unordered_map<unsigned long long,std::list<_TexturePage>::iterator> pages; ///< resident pages by key
+    long long                           bytes = 0; ///< resident bytes
+};
+
+struct _TextureThreadSlot {
+    unsigned long long                  key = ~0ull; ///< held page key
+    shared_ptr<vector<unsigned char>>   data; ///< held page, kept alive even if evicted from the shared cache
+};
+
+_TextureCacheShard _texture_cache_shards[TextureCache::shards]; ///< shared page cache
+thread_local _TextureThreadSlot _texture_thread_slots[TextureCache::thread_slots]; ///< per-thread pages, direct mapped
+thread_local TextureCacheStats _texture_cache_stats; ///< per-thread cache counters
+TextureCacheStats _texture_cache_stats_total; ///< merged cache counters
+std::mutex _texture_cache_stats_mutex; ///< lock for merged counters
+std::atomic<long long> _texture_cache_resident(0); ///< bytes resident in the shared cache
+std::atomic<long long> _texture_cache_peak(0); ///< peak bytes resident in the shared cache
+
+unsigned long long _texture_cache_mix(unsigned long long key) { return (key * 0x9E3779B97F4A7C15ull) >> 32; }
+
+shared_ptr<vector<unsigned char>> texture_cache_page(const TextureTiles& tiles, unsigned long long key, long long page) {
+    auto& shard = _texture_cache_shards[_texture_cache_mix(key) % TextureCache::shards];
+    {
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        auto it = shard.pages.find(key);
+        if(it != shard.pages.end()) {
+            shard.lru.splice(shard.lru.begin(), shard.lru, it->second);
+            _texture_cache_stats.hits ++;
+            return it->second->data;
+        }
+    }
+    
+    // read outside the lock, so the other pages of the shard stay available
+    auto begin = page * tiles._page_bytes;
+    auto size = (long long)tiles._page_bytes;
+    if(begin + size > tiles._page_total) size = tiles._page_total - begin;
+    auto data = std::make_shared<vector<unsigned char>>(size);
+    if(pread(tiles._page_fd, data->data(), size, tiles._page_offset + begin) != size) WARNING("cannot read texture cache page");
+    _texture_cache_stats.misses ++;
+    
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    auto it = shard.pages.find(key);
+    if(it != shard.pages.end()) return it->second->data;
+    shard.lru.push_front(_TexturePage{key, data});
+    shard.pages[key] = shard.lru.begin();
+    shard.bytes += size;
+    auto resident = (_texture_cache_resident += size);
+    auto peak = _texture_cache_peak.load();
+    while(resident > peak and not _texture_cache_peak.compare_exchange_weak(peak, resident)) { }
+    while(shard.bytes > TextureCache::budget / TextureCache::shards and shard.lru.size() > 1) {
+        auto& victim = shard.lru.back();
+        shard.bytes -= victim.data->size();
+        _texture_cache_resident -= victim.data->size();
+        shard.pages.erase(victim.key);
+        shard.lru.pop_back();
+        _texture_cache_stats.evictions ++;
+    }
+    return data;
+}
+
+const unsigned char* texture_cache_texel(const TextureTiles& tiles, long long offset) {
+    auto page = offset / tiles._page_bytes;
+    auto key = ((unsigned long long)tiles._cache_id << 32) | (unsigned long long)page;
+    auto& slot = _texture_thread_slots[_texture_cache_mix(key) % TextureCache::thread_slots];
+    _texture_cache_stats.lookups ++;
+    if(slot.key == key) _texture_cache_stats.thread_hits ++;
+    else {
+        slot.data = texture_cache_page(tiles, key, page);
+        slot.key = key;
+    }
+    return slot.data->data() + (offset - page * tiles._page_bytes);
+}
+
+void texture_cache_stats_flush() {
+    std::lock_guard<std::mutex> lock(_texture_cache_stats_mutex);
+    _texture_cache_stats_total.lookups += _texture_cache_stats.lookups;
+    _texture_cache_stats_total.thread_hits += _texture_cache_stats.thread_hits;
+    _texture_cache_stats_total.hits += _texture_cache_stats.hits;
+    _texture_cache_stats_total.misses += _texture_cache_stats.misses;
+    _texture_cache_stats_total.evictions += _texture_cache_stats.evictions;
+    _texture_cache_stats = TextureCacheStats();
+}
+
+TextureCacheStats texture_cache_stats() {
+    std::lock_guard<std::mutex> lock(_texture_cache_stats_mutex);
+    auto stats = _texture_cache_stats_total;
+    stats.resident_bytes = _texture_cache_resident;
+    stats.peak_bytes = _texture_cache_peak;
+    return stats;
+}
+
+void texture_cache_stats_reset() {
+    std::lock_guard<std::mutex> lock(_texture_cache_stats_mutex);
+    _texture_cache_stats_total = TextureCacheStats();
+    _texture_cache_stats = TextureCacheStats();
+    _texture_cache_peak = _texture_cache_resident.load();
+}
+
+image3f texture_image(Texture* texture) {
+    if(texture->_levels.empty()) return texture->image;
+    auto& tiles = texture->_levels[0];
+    auto img = image3f(tiles.width, tiles.height);
+    for(auto j : range(tiles.height)) {
+        for(auto i : range(tiles.width)) img.at(i,j) = texture_tiles_at(tiles, i, j);
+    }
+    return img;
+}
+
+TextureStats texture_stats() { return _texture_stats; }
+
+void texture_stats_reset() { _texture_stats = TextureStats(); }
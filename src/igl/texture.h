@@ -9,18 +9,283 @@
 ///@ingroup igl
 ///@{
 
+/// Texture level stored in square tiles, with texels in Morton order inside each tile.
+/// Bilinear footprints and neighbouring shading points stay within a few cache lines.
+/// Texels are kept in a compact format and decoded to floats on lookup.
+struct TextureTiles {
+    static const int tile_bits = 2; ///< log2 of the tile size
+    static const int tile_size = 1 << tile_bits; ///< tile size (4x4 texels of 12 bytes span three cache lines)
+    
+    enum Format { rgbf, rgb8, rgb565, rgbh }; ///< texel formats (float, 8 bits per channel, 5/6/5 bits, half float)
+    
+    Format                  format = rgbf; ///< texel format
+    int                     texel_bytes = 12; ///< bytes per texel
+    int                     width = 0; ///< width in texels
+    int                     height = 0; ///< height in texels
+    int                     tiles_x = 0; ///< tiles per row
+    vector<unsigned char>   data; ///< texels, tile by tile (tiles are padded at the right and top borders), empty if paged
+    
+    int                     _cache_id = -1; ///< level id in the texture cache (-1 if resident)
+    int                     _page_fd = -1; ///< paged file descriptor
+    long long               _page_offset = 0; ///< level offset in the paged file
+    int                     _page_bytes = 0; ///< bytes per page (whole tile rows)
+    long long               _page_total = 0; ///< level bytes
+};
+
+/// Out-of-core texture cache settings. Textures are written once, tiled, to the cache directory,
+/// then pages of tile rows are read on demand and evicted in LRU order past the memory budget.
+struct TextureCache {
+    static string                       cache_dir; ///< directory for paged textures (empty to keep textures resident)
+    static long long                    budget; ///< memory budget in bytes for resident pages
+    static const int                    page_bytes = 65536; ///< target page size (rounded to whole tile rows)
+    static const int                    shards = 16; ///< independently locked parts of the cache, each with its share of the budget
+    static const int                    thread_slots = 16; ///< pages held by each thread without locking (outside the budget)
+};
+
 /// Color Texture from a file
 struct Texture : Node {
     REGISTER_FAST_RTTI(Node,Texture,15)
     
     string  filename; ///< texture filename
     
-	image3f image; ///< texture image
+	image3f image; ///< texture image (released once the levels are built)
     bool flipy = true; ///< whether to flip the images on load
+    string format = "auto"; ///< texel storage: auto (rgb8 for 8-bit files, float otherwise), float, rgb8, rgb565 or half
+    
+    vector<TextureTiles> _levels; ///< tiled image and mip pyramid (each level half the previous one), built on load
     
     unsigned int _shade_glid = 0; ///< opengl shading texture id
+    
+    /// Destructor (closes the paged file of the levels)
+    ~Texture();
+};
+
+///@name texel format interface
+///@{
+
+/// half float to float
+inline float _texture_half_to_float(unsigned short h) {
+    unsigned int sign = (h & 0x8000u) << 16, exp = (h >> 10) & 0x1f, mant = h & 0x3ff;
+    unsigned int bits;
+    if(exp == 0) {
+        auto f = mant / 16777216.0f;
+        return (sign) ? -f : f;
+    }
+    else if(exp == 31) bits = sign | 0x7f800000u | (mant << 13);
+    else bits = sign | ((exp + 112) << 23) | (mant << 13);
+    float f; memcpy(&f, &bits, 4);
+    return f;
+}
+
+/// float to half float, rounding to nearest and saturating to infinity
+inline unsigned short _texture_float_to_half(float f) {
+    unsigned int bits; memcpy(&bits, &f, 4);
+    unsigned int sign = (bits >> 16) & 0x8000u, mant = bits & 0x7fffff;
+    int fexp = (bits >> 23) & 0xff, exp = fexp - 127 + 15;
+    if(fexp == 0xff) return sign | 0x7c00u | ((mant) ? 0x200u : 0);
+    if(exp >= 31) return sign | 0x7c00u;
+    if(exp <= 0) {
+        if(exp < -10) return sign;
+        mant |= 0x800000u;
+        auto shift = 14 - exp;
+        auto h = mant >> shift;
+        if((mant >> (shift-1)) & 1) h ++;
+        return sign | h;
+    }
+    auto h = sign | (exp << 10) | (mant >> 13);
+    if(mant & 0x1000u) h ++;
+    return h;
+}
+
+/// bytes per texel of a format
+inline int texture_format_bytes(TextureTiles::Format format) {
+    switch(format) {
+        case TextureTiles::rgbf: return 12;
+        case TextureTiles::rgb8: return 3;
+        case TextureTiles::rgb565: return 2;
+        case TextureTiles::rgbh: return 6;
+        default: { NOT_IMPLEMENTED_ERROR(); return 0; }
+    }
+}
+
+/// decode a texel
+inline vec3f texture_format_decode(TextureTiles::Format format, const unsigned char* texel) {
+    switch(format) {
+        case TextureTiles::rgbf: { vec3f c; memcpy(&c, texel, 12); return c; }
+        case TextureTiles::rgb8: return vec3f(texel[0],texel[1],texel[2]) / 255.0f;
+        case TextureTiles::rgb565: {
+            unsigned short v; memcpy(&v, texel, 2);
+            return vec3f((v >> 11) / 31.0f, ((v >> 5) & 63) / 63.0f, (v & 31) / 31.0f);
+        }
+        case TextureTiles::rgbh: {
+            unsigned short h[3]; memcpy(h, texel, 6);
+            return vec3f(_texture_half_to_float(h[0]),_texture_half_to_float(h[1]),_texture_half_to_float(h[2]));
+        }
+        default: { NOT_IMPLEMENTED_ERROR(); return zero3f; }
+    }
+}
+
+/// encode a texel
+inline void texture_format_encode(TextureTiles::Format format, const vec3f& c, unsigned char* texel) {
+    switch(format) {
+        case TextureTiles::rgbf: memcpy(texel, &c, 12); break;
+        case TextureTiles::rgb8: {
+            texel[0] = (unsigned char)round(clamp(c.x,0.0f,1.0f)*255);
+            texel[1] = (unsigned char)round(clamp(c.y,0.0f,1.0f)*255);
+            texel[2] = (unsigned char)round(clamp(c.z,0.0f,1.0f)*255);
+        } break;
+        case TextureTiles::rgb565: {
+            unsigned short v = ((unsigned short)round(clamp(c.x,0.0f,1.0f)*31) << 11) |
+                               ((unsigned short)round(clamp(c.y,0.0f,1.0f)*63) << 5) |
+                               (unsigned short)round(clamp(c.z,0.0f,1.0f)*31);
+            memcpy(texel, &v, 2);
+        } break;
+        case TextureTiles::rgbh: {
+            unsigned short h[3] = { _texture_float_to_half(c.x), _texture_float_to_half(c.y), _texture_float_to_half(c.z) };
+            memcpy(texel, h, 6);
+        } break;
+        default: NOT_IMPLEMENTED_ERROR();
+    }
+}
+
+/// format from its name ("auto" is resolved by the file extension)
+TextureTiles::Format texture_format_parse(const string& format, const string& filename);
+
+///@}
+
+///@name tiled storage interface
+///@{
+
+/// spread the low tile bits of x to the even bits
+inline int _texture_tiles_spread(int x) { return (x & 1) | ((x & 2) << 1) | ((x & 4) << 2); }
+
+/// index of texel (i,j) in the tiled storage
+inline int texture_tiles_index(const TextureTiles& tiles, int i, int j) {
+    auto mask = TextureTiles::tile_size - 1;
+    auto tile = (j >> TextureTiles::tile_bits) * tiles.tiles_x + (i >> TextureTiles::tile_bits);
+    return (tile << (2*TextureTiles::tile_bits)) | _texture_tiles_spread(i & mask) | (_texture_tiles_spread(j & mask) << 1);
+}
+
+/// texel at a byte offset of a paged level, loading its page if needed
+const unsigned char* texture_cache_texel(const TextureTiles& tiles, long long offset);
+
+/// texel (i,j) of a tiled level, decoded to float
+inline vec3f texture_tiles_at(const TextureTiles& tiles, int i, int j) {
+    auto offset = (long long)texture_tiles_index(tiles, i, j) * tiles.texel_bytes;
+    if(tiles._cache_id >= 0) return texture_format_decode(tiles.format, texture_cache_texel(tiles, offset));
+    return texture_format_decode(tiles.format, tiles.data.data() + offset);
+}
+
+/// convert an image to tiled storage in the given format
+TextureTiles texture_tiles_make(const image3f& img, TextureTiles::Format format);
+
+///@}
+
+///@name mipmap interface
+///@{
+
+/// build the tiled levels, with the mip pyramid made by a 2x2 box filter down to a single texel,
+/// and release the source image
+void texture_levels_init(Texture* texture);
+
+/// load the texture file into tiled levels, paging them through the texture cache if enabled
+void texture_load(Texture* texture);
+
+/// release the texture levels, closing their paged file (shared by the levels) if any
+void texture_release(Texture* texture);
+
+/// number of texture levels (the image and its mips)
+inline int texture_levels(Texture* texture) { return texture->_levels.size(); }
+
+/// texture image decoded from the finest level
+image3f texture_image(Texture* texture);
+
+/// bytes held by the texture levels, resident or paged
+inline long long texture_bytes(Texture* texture) {
+    long long bytes = 0;
+    for(auto& level : texture->_levels) bytes += (level._cache_id >= 0) ? level._page_total : (long long)level.data.size();
+    return bytes;
+}
+
+///@}
+
+/// texture memory statistics
+struct TextureStats {
+    int                 textures = 0; ///< textures loaded
+    long long           bytes = 0; ///< bytes in texture levels
+    long long           float_bytes = 0; ///< bytes the levels would take with float texels
+    long long           paged_bytes = 0; ///< bytes of levels paged through the texture cache
+};
+
+///@name texture memory statistics interface
+///@{
+TextureStats texture_stats();
+void texture_stats_reset();
+///@}
+
+/// texture cache statistics
+struct TextureCacheStats {
+    long long           lookups = 0; ///< page lookups
+    long long           thread_hits = 0; ///< lookups served by the per-thread pages
+    long long           hits = 0; ///< lookups served by the shared cache
+    long long           misses = 0; ///< pages read from disk
+    long long           evictions = 0; ///< pages evicted
+    long long           resident_bytes = 0; ///< bytes of pages in the shared cache
+    long long           peak_bytes = 0; ///< peak bytes of pages in the shared cache
 };
 
+///@name texture cache statistics interface
+///@{
+void texture_cache_stats_flush();
+TextureCacheStats texture_cache_stats();
+void texture_cache_stats_reset();
+///@}
+
+///@name lookup interface
+///@{
+
+/// texel index wrapped to repeat the texture
+inline int _texture_wrap(int i, int size) {
+    i %= size;
+    return (i < 0) ? i + size : i;
+}
+
+/// nearest texel lookup (repeats the texture outside [0,1])
+inline vec3f texture_lookup_nearest(Texture* texture, const vec2f& texcoord) {
+    if(texture->_levels.empty()) return zero3f;
+    auto& tiles = texture->_levels[0];
+    auto i = _texture_wrap((int)floor(texcoord.x*tiles.width), tiles.width);
+    auto j = _texture_wrap((int)floor(texcoord.y*tiles.height), tiles.height);
+    return texture_tiles_at(tiles,i,j);
+}
+
+/// bilinear lookup in a texture level (repeats the texture outside [0,1])
+inline vec3f texture_lookup_bilinear(Texture* texture, int level, const vec2f& texcoord) {
+    auto& tiles = texture->_levels[level];
+    auto u = texcoord.x*tiles.width - 0.5f, v = texcoord.y*tiles.height - 0.5f;
+    auto fu = floor(u), fv = floor(v);
+    auto su = u - fu, sv = v - fv;
+    auto i0 = _texture_wrap((int)fu, tiles.width), j0 = _texture_wrap((int)fv, tiles.height);
+    auto i1 = _texture_wrap(i0+1, tiles.width), j1 = _texture_wrap(j0+1, tiles.height);
+    return (texture_tiles_at(tiles,i0,j0) * (1-su) + texture_tiles_at(tiles,i1,j0) * su) * (1-sv) +
+           (texture_tiles_at(tiles,i0,j1) * (1-su) + texture_tiles_at(tiles,i1,j1) * su) * sv;
+}
+
+/// trilinear lookup, with the level chosen by the footprint width in texcoord units
+inline vec3f texture_lookup_trilinear(Texture* texture, const vec2f& texcoord, float width) {
+    if(texture->_levels.empty()) return zero3f;
+    auto size = max(texture->_levels[0].width,texture->_levels[0].height);
+    auto lod = (width * size > 1) ? log2(width * size) : 0.0f;
+    auto maxlevel = texture_levels(texture) - 1;
+    if(lod >= maxlevel) return texture_lookup_bilinear(texture, maxlevel, texcoord);
+    auto level = (int)lod;
+    auto s = lod - level;
+    if(s == 0) return texture_lookup_bilinear(texture, level, texcoord);
+    return texture_lookup_bilinear(texture, level, texcoord) * (1-s) + texture_lookup_bilinear(texture, level+1, texcoord) * s;
+}
+
+///@}
+
 
 ///@}
 
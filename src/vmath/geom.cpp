@@ -38,14 +38,17 @@ bool intersect_triangle(const ray3f& ray,
     return true;
 }
 
+// the discriminant is computed from the distance of the center to the ray, rather than as b*b-4*a*c,
+// since the latter cancels for small spheres far from the ray origin and accepts hits outside the sphere
 bool intersect_sphere(const ray3f& ray, const vec3f& o, float r, float& t) {
     auto a = lengthSqr(ray.d);
-    auto b = 2*dot(ray.d,ray.e-o);
-    auto c = lengthSqr(ray.e-o) - r*r;
-    auto d = b*b-4*a*c;
+    auto f = ray.e-o;
+    auto tc = -dot(ray.d,f) / a;
+    auto d = r*r - lengthSqr(f + tc*ray.d);
     if(d < 0) return false;
-    auto tmin = (-b-sqrt(d)) / (2*a);
-    auto tmax = (-b+sqrt(d)) / (2*a);
+    auto h = sqrt(d / a);
+    auto tmin = tc - h;
+    auto tmax = tc + h;
     if (tmin >= ray.tmin && tmin <= ray.tmax) {
         t = tmin;
         return true;
@@ -92,6 +95,35 @@ bool intersect_quad(const ray3f& ray, float w, float h, float& t, float& ba, flo
     return true;
 }
 
+// quad split along the v0-v2 diagonal, as in tesselation; returns the closest half hit (0: v0,v1,v2; 1: v0,v2,v3).
+// Both halves are tested together with the signed volumes spanned by the ray and each edge (Plucker coordinates,
+// relative to the ray origin): a half is hit if the volumes of its three edges agree in sign, and they give its
+// barycentrics. The four sides and the shared diagonal are computed once; the diagonal enters the halves with
+// opposite signs, so rays cannot slip between them. Both halves pass only for non-planar quads, where the closest wins.
+bool intersect_quad(const ray3f& ray, const vec3f& v0, const vec3f& v1, const vec3f& v2, const vec3f& v3, float& t, float& ba, float& bb, int& half) {
+    auto p0 = v0 - ray.e, p1 = v1 - ray.e, p2 = v2 - ray.e, p3 = v3 - ray.e;
+    auto w01 = dot(ray.d,cross(p0,p1));
+    auto w12 = dot(ray.d,cross(p1,p2));
+    auto w23 = dot(ray.d,cross(p2,p3));
+    auto w30 = dot(ray.d,cross(p3,p0));
+    auto w20 = dot(ray.d,cross(p2,p0));
+    auto dd = dot(ray.d,ray.d);
+    bool hit = false;
+    // the volume of each edge weights the vertex opposite to it
+    auto intersect_half = [&](int h, float wa, float wb, float wc, const vec3f& pa, const vec3f& pb, const vec3f& pc) {
+        if(not ((wa >= 0 and wb >= 0 and wc >= 0) or (wa <= 0 and wb <= 0 and wc <= 0))) return;
+        auto w = wa + wb + wc;
+        if(w == 0) return;
+        auto sba = wa / w, sbb = wb / w;
+        auto st = dot(sba*pa + sbb*pb + (1-sba-sbb)*pc, ray.d) / dd;
+        if(st < ray.tmin or st > ray.tmax or (hit and st >= t)) return;
+        hit = true; half = h; t = st; ba = sba; bb = sbb;
+    };
+    intersect_half(0, w12, w20, w01, p0, p1, p2);
+    intersect_half(1, w23, w30, -w20, p0, p2, p3);
+    return hit;
+}
+
 // http://geomalgorithms.com/a02-_lines.html
 //    distance( Point P,  Segment P0:P1 )
 //    {
@@ -29,6 +29,11 @@ inline vec2f direction_to_latlong(const vec3f& w) { auto a = direction_to_unitsp
 inline range3f triangle_bounds(const vec3f& v0, const vec3f& v1, const vec3f& v2) { return range_from_values(v0,v1,v2); }
 inline range3f sphere_bounds(const vec3f& pos, float r) { return range3f(pos-vec3f(r,r,r),pos+vec3f(r,r,r)); }
 inline range3f cylinder_bounds(float r, float h) { return range3f(vec3f(-r,-r,0),vec3f(r,r,h)); }
+inline range3f cylinder_bounds(const vec3f& v0, const vec3f& v1, float r) {
+    if(v0 == v1) return sphere_bounds(v0,r);
+    auto a = normalize(v1-v0);
+    auto e = r*vec3f(sqrt(max(0.0f,1-a.x*a.x)),sqrt(max(0.0f,1-a.y*a.y)),sqrt(max(0.0f,1-a.z*a.z)));
+    return range3f(min(v0,v1)-e,max(v0,v1)+e); }
 inline range3f quad_bounds(float w, float h) { return range3f(vec3f(-w/2,-h/2,0),vec3f(w/2,h/2,0)); }
 inline range3f quad_bounds(const vec3f& v0, const vec3f& v1, const vec3f& v2, const vec3f& v3) { return range_from_values(v0,v1,v2,v3); }
 ///@}
@@ -42,6 +47,7 @@ inline vec3f quad_normal(const vec3f& v0, const vec3f& v1, const vec3f& v2, cons
 ///@name volume
 ///@{
 inline float sphere_area(float r) { return 4*pi*r*r; }
+inline float triangle_area(const vec3f& v0, const vec3f& v1, const vec3f& v2) { return length(cross(v1-v0,v2-v0))/2; }
 ///@}
 
 ///@name volume
@@ -55,6 +61,7 @@ bool intersect_bbox(const ray3f& ray, const range3f& bbox, float& t0, float& t1)
 bool intersect_triangle(const ray3f& ray, const vec3f& v0, const vec3f& v1, const vec3f& v2, float& t, float& ba, float& bb);
 bool intersect_sphere(const ray3f& ray, const vec3f& o, float r, float& t);
 bool intersect_quad(const ray3f& ray, float w, float h, float& t, float& ba, float& bb);
+bool intersect_quad(const ray3f& ray, const vec3f& v0, const vec3f& v1, const vec3f& v2, const vec3f& v3, float& t, float& ba, float& bb, int& half);
 bool intersect_cylinder(const ray3f& ray, float r, float h, float& t);
 bool intersect_point_approximate(const ray3f& ray, const vec3f& p, float r, float& t);
 bool intersect_line_approximate(const ray3f& ray, const vec3f& v0, const vec3f& v1, float r0, float r1, float& t, float& s);
@@ -66,6 +73,7 @@ inline bool intersect_bbox(const ray3f& ray, const range3f& bbox) { float t0, t1
 inline bool intersect_triangle(const ray3f& ray, const vec3f& v0, const vec3f& v1, const vec3f& v2) { float t, ba, bb; return intersect_triangle(ray, v0, v1, v2, t, ba, bb); }
 inline bool intersect_sphere(const ray3f& ray, const vec3f& o, float r) { float t; return intersect_sphere(ray, o, r, t); }
 inline bool intersect_quad(const ray3f& ray, float w, float h) { float t, ba, bb; return intersect_quad(ray,w,h,t,ba,bb); }
+inline bool intersect_quad(const ray3f& ray, const vec3f& v0, const vec3f& v1, const vec3f& v2, const vec3f& v3) { float t, ba, bb; int half; return intersect_quad(ray, v0, v1, v2, v3, t, ba, bb, half); }
 inline bool intersect_cylinder(const ray3f& ray, float r, float h) { float t; return intersect_cylinder(ray,r,h,t); }
 inline bool intersect_point_approximate(const ray3f& ray, const vec3f& p, float r) { float t; return intersect_point_approximate(ray, p, r, t); }
 inline bool intersect_line_approximate(const ray3f& ray, const vec3f& v0, const vec3f& v1, float r0, float r1) { float t, s; return intersect_line_approximate(ray, v0, v1, r0, r1, t, s); }
@@ -148,86 +148,123 @@ struct DistrubutionSample2D {
     float   pdf;
 };
 
+/// piecewise constant distribution over [0,1), sampled in constant time with an alias table (Walker/Vose)
 struct Distribution1D {
     vector<float>           values;
-    vector<float>           cdf;
-    float                   integral;
+    vector<float>           prob; ///< probability of keeping a bucket over its alias
+    vector<int>             alias; ///< bucket taken otherwise
+    float                   integral; ///< mean of the values
 };
 
+/// piecewise constant distribution over [0,1)^2, with the conditional rows stored contiguously
 struct Distribution2D {
-    vector<Distribution1D>  conditionalV;
-    Distribution1D          marginal;
+    int                     width = 0; ///< values per row
+    int                     height = 0; ///< rows
+    vector<float>           values; ///< row values, row by row
+    vector<float>           prob; ///< row alias tables probabilities, row by row
+    vector<int>             alias; ///< row alias tables aliases, row by row
+    vector<float>           integral; ///< row integrals
+    Distribution1D          marginal; ///< distribution of the rows
 };
 
-inline Distribution1D sample_init_distribution1d(const vector<float>& values) {
-    Distribution1D dist;
-    
-    dist.values = values;
-    dist.cdf.resize(values.size()+1);
-    
-    dist.cdf[0] = 0;
-    for (int i = 1; i < dist.cdf.size(); ++i) {
-        // TODO: why the division by size?
-        dist.cdf[i] = dist.cdf[i-1] + dist.values[i-1] / dist.values.size();
+// builds the alias table of n values with the given sum; zero sums give a uniform table
+inline void _sample_init_alias(const float* values, int n, double sum, float* prob, int* alias) {
+    vector<double> scaled(n);
+    vector<int> small, large;
+    for(int i = 0; i < n; i ++) {
+        scaled[i] = (sum > 0) ? values[i] * n / sum : 1;
+        if(scaled[i] < 1) small.push_back(i);
+        else large.push_back(i);
     }
-    
-    dist.integral = dist.cdf[dist.values.size()];
-    if (dist.integral == 0.f) {
-        for (int i = 1; i < dist.cdf.size(); ++i) dist.cdf[i] = float(i) / float(dist.values.size());
+    while(not small.empty() and not large.empty()) {
+        auto s = small.back(); small.pop_back();
+        auto l = large.back(); large.pop_back();
+        prob[s] = scaled[s];
+        alias[s] = l;
+        scaled[l] = (scaled[l] + scaled[s]) - 1;
+        if(scaled[l] < 1) small.push_back(l);
+        else large.push_back(l);
+    }
+    // leftovers are full buckets, up to rounding
+    for(auto l : large) { prob[l] = 1; alias[l] = l; }
+    for(auto s : small) { prob[s] = 1; alias[s] = s; }
+}
+
+// samples an alias table, remapping u within the bucket so the value is uniform inside it
+inline DistrubutionSample1D _sample_alias(const float* values, const float* prob, const int* alias, int n, float integral, float u) {
+    DistrubutionSample1D ret;
+    auto un = min(u, 0.999999f) * n;
+    auto i = min(int(un), n-1);
+    auto du = un - i;
+    if(du < prob[i]) {
+        ret.index = i;
+        du = du / prob[i];
     } else {
-        for (int i = 1; i < dist.cdf.size(); ++i) dist.cdf[i] /= dist.integral;
+        ret.index = alias[i];
+        du = (du - prob[i]) / (1 - prob[i]);
     }
-    
+    ret.pdf = (integral > 0) ? values[ret.index] / integral : 1;
+    ret.value = (ret.index + min(du, 0.999999f)) / n;
+    return ret;
+}
+
+inline Distribution1D sample_init_distribution1d(const vector<float>& values) {
+    Distribution1D dist;
+    dist.values = values;
+    dist.prob.resize(values.size());
+    dist.alias.resize(values.size());
+    double sum = 0;
+    for(auto v : values) sum += v;
+    dist.integral = sum / values.size();
+    _sample_init_alias(dist.values.data(), dist.values.size(), sum, dist.prob.data(), dist.alias.data());
     return dist;
 }
 
 inline Distribution2D sample_init_distribution2d(const vector<vector<float>>& values) {
     Distribution2D dist;
-    dist.conditionalV.resize(values.size());
-    vector<float> condBuffer(values[0].size());
-    for (int v = 0; v < values.size(); v++) {
-        for(int u = 0; u < values[v].size(); u++)
-            condBuffer[u] = values[v][u];
-        dist.conditionalV[v] = sample_init_distribution1d(condBuffer);
+    dist.height = values.size();
+    dist.width = values[0].size();
+    dist.values.resize(dist.width*dist.height);
+    dist.prob.resize(dist.width*dist.height);
+    dist.alias.resize(dist.width*dist.height);
+    dist.integral.resize(dist.height);
+    for (int v = 0; v < dist.height; v++) {
+        auto row = v*dist.width;
+        double sum = 0;
+        for(int u = 0; u < dist.width; u++) {
+            dist.values[row+u] = values[v][u];
+            sum += values[v][u];
+        }
+        dist.integral[v] = sum / dist.width;
+        _sample_init_alias(dist.values.data()+row, dist.width, sum, dist.prob.data()+row, dist.alias.data()+row);
     }
     // Compute marginal sampling distribution $p[\tilde{v}]$
-    vector<float> marginalFunc(values.size());
-    for (int v = 0; v < values.size(); ++v)
-        marginalFunc[v] = dist.conditionalV[v].integral;
-    dist.marginal = sample_init_distribution1d(marginalFunc);
+    dist.marginal = sample_init_distribution1d(dist.integral);
     return dist;
 }
 
 inline DistrubutionSample1D sample_distribution1d(Distribution1D* dist, float u) {
-    DistrubutionSample1D ret;
-    
-    // TODO: why is this needed?
-    // HACK: this should not be here
-    u = clamp(u, 0.0f, 0.999999f);
-    
-    auto cdf = &dist->cdf[0];
-    auto ptr = std::upper_bound(cdf, cdf+dist->cdf.size(), u);
-    ret.index = max(0, int(ptr-cdf-1));
-    ERROR_IF_NOT(ret.index < dist->values.size(), "incorrect cdf sampling");
-    ERROR_IF_NOT(u >= cdf[ret.index] && u < cdf[ret.index+1], "incorrect cdf sampling");
-    
-    auto du = (u - cdf[ret.index]) / (cdf[ret.index+1] - cdf[ret.index]);
-    ERROR_IF_NOT(not std::isnan(du), "problem with du");
-    
-    ret.pdf = dist->values[ret.index] / dist->integral;
-    ret.value =  (ret.index + du) / dist->values.size();
-    
-    return ret;
+    return _sample_alias(dist->values.data(), dist->prob.data(), dist->alias.data(), dist->values.size(), dist->integral, u);
 }
 
 inline DistrubutionSample2D sample_distribution2d(Distribution2D* dist, const vec2f& uv) {
     DistrubutionSample2D ret;
     auto sampleY = sample_distribution1d(&dist->marginal, uv.y);
-    auto sampleX = sample_distribution1d(&dist->conditionalV[sampleY.index], uv.x);
+    auto row = sampleY.index*dist->width;
+    auto sampleX = _sample_alias(dist->values.data()+row, dist->prob.data()+row, dist->alias.data()+row,
+                                 dist->width, dist->integral[sampleY.index], uv.x);
     ret.value = vec2f(sampleX.value,sampleY.value);
     ret.pdf = sampleX.pdf * sampleY.pdf;
     return ret;
 }
+
+// pdf of sampling uv in [0,1)^2, matching sample_distribution2d
+inline float sample_distribution2d_pdf(Distribution2D* dist, const vec2f& uv) {
+    if(not (dist->marginal.integral > 0)) return 1;
+    auto i = clamp(int(uv.x*dist->width), 0, dist->width-1);
+    auto j = clamp(int(uv.y*dist->height), 0, dist->height-1);
+    return dist->values[j*dist->width+i] / dist->marginal.integral;
+}
 // end - from pbrt
 
 #endif
\ No newline at end of file